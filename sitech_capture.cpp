@@ -0,0 +1,166 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sitech_capture.h"
+#include "sitech_clock.h"
+
+SiTechCaptureWriter::SiTechCaptureWriter() : fp(NULL), buffer(NULL), active(false), writeFailed(false), bytes(0), lastFlush(0)
+{
+}
+
+SiTechCaptureWriter::~SiTechCaptureWriter()
+{
+    close();
+}
+
+bool SiTechCaptureWriter::open(const char *path, char *err, size_t errLen)
+{
+    close();
+
+    std::lock_guard<std::mutex> guard(lock);
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) fp = fdopen(fd, "wb");
+    if (fp == NULL)
+    {
+        snprintf(err, errLen, "%s: %s", path, strerror(errno));
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    buffer = (char *) malloc(CAPTURE_BUFFER_SIZE);
+    if (buffer != NULL) setvbuf(fp, buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    SiTechCaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SITECH_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = SITECH_CAPTURE_VERSION;
+    header.recordSize = sizeof(SiTechCaptureRecord);
+    header.startTime = SiTechHostTime();
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0)
+    {
+        snprintf(err, errLen, "%s: %s", path, strerror(errno));
+        fclose(fp);
+        fp = NULL;
+        free(buffer);
+        buffer = NULL;
+        return false;
+    }
+
+    bytes = 0;
+    writeFailed = false;
+    lastFlush = header.startTime;
+    active = true;
+    return true;
+}
+
+void SiTechCaptureWriter::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    active = false;
+    if (fp != NULL) fclose(fp);
+    fp = NULL;
+    free(buffer);
+    buffer = NULL;
+}
+
+void SiTechCaptureWriter::record(int link, SiTechCaptureDirection direction, const char *data, size_t len, double time)
+{
+    if (!active || len == 0) return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (fp == NULL) return;
+
+    SiTechCaptureRecord rec;
+    rec.time = time;
+    rec.length = (uint32_t) len;
+    rec.link = (uint8_t) link;
+    rec.direction = (uint8_t) direction;
+    rec.reserved = 0;
+    if (fwrite(&rec, sizeof(rec), 1, fp) != 1 || fwrite(data, 1, len, fp) != len)
+    {
+        // Disk full or gone: stop rather than leave a torn record behind every exchange
+        active = false;
+        writeFailed = true;
+        return;
+    }
+    bytes += len;
+
+    if (time - lastFlush >= CAPTURE_FLUSH_INTERVAL)
+    {
+        fflush(fp);
+        lastFlush = time;
+    }
+}
+
+SiTechCaptureReader::SiTechCaptureReader() : fp(NULL)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+SiTechCaptureReader::~SiTechCaptureReader()
+{
+    close();
+}
+
+bool SiTechCaptureReader::open(const char *path, char *err, size_t errLen)
+{
+    close();
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        snprintf(err, errLen, "%s: %s", path, strerror(errno));
+        return false;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, SITECH_CAPTURE_MAGIC, sizeof(header.magic)) != 0
+            || header.recordSize != sizeof(SiTechCaptureRecord))
+    {
+        snprintf(err, errLen, "%s: not a capture written on this kind of machine", path);
+        close();
+        return false;
+    }
+    if (header.version != SITECH_CAPTURE_VERSION)
+    {
+        snprintf(err, errLen, "%s: capture version %u, expected %d", path, header.version, SITECH_CAPTURE_VERSION);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SiTechCaptureReader::close()
+{
+    if (fp != NULL) fclose(fp);
+    fp = NULL;
+}
+
+bool SiTechCaptureReader::next(SiTechCaptureRecord *rec, char *data, size_t dataLen)
+{
+    if (fp == NULL || fread(rec, sizeof(*rec), 1, fp) != 1) return false;
+
+    size_t keep = rec->length < dataLen ? rec->length : dataLen;
+    if (fread(data, 1, keep, fp) != keep) return false;
+    // A torn last record ends the capture
+    if (keep < rec->length && fseek(fp, rec->length - keep, SEEK_CUR) != 0) return false;
+    rec->length = (uint32_t) keep;
+    return true;
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Raw capture of the bytes exchanged with SiTechExe.
+ *
+ * A capture file is a SiTechCaptureHeader followed by records, each a
+ * SiTechCaptureRecord and then its bytes exactly as they were written to or
+ * read from the socket.  Writes are recorded per send, reads per read(), so a
+ * reply split over two segments shows up as two records.  Times are
+ * CLOCK_REALTIME seconds, taken right after the system call.  Integers and
+ * doubles are in host byte order; the magic tells a foreign capture apart.
+ *
+ * Recording is buffered and flushed about once a second, so at most the last
+ * second is lost if the driver dies.
+ */
+
+#ifndef SITECH_CAPTURE_H
+#define SITECH_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+
+#define SITECH_CAPTURE_MAGIC    "SITECAP"       /* 7 characters and the NUL */
+#define SITECH_CAPTURE_VERSION  1
+#define CAPTURE_FLUSH_INTERVAL  1.0             /* seconds between flushes */
+#define CAPTURE_BUFFER_SIZE     65536
+
+enum SiTechCaptureDirection
+{
+    CAPTURE_SENT,           /* driver to SiTechExe */
+    CAPTURE_RECEIVED        /* SiTechExe to driver, late replies thrown away included */
+};
+
+struct SiTechCaptureHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;    /* sizeof(SiTechCaptureRecord) */
+    double startTime;
+};
+
+struct SiTechCaptureRecord
+{
+    double time;
+    uint32_t length;        /* bytes that follow */
+    uint8_t link;           /* 0 main connection, 1 priority connection */
+    uint8_t direction;      /* SiTechCaptureDirection */
+    uint16_t reserved;
+};
+
+class SiTechCaptureWriter
+{
+public:
+    SiTechCaptureWriter();
+    ~SiTechCaptureWriter();
+
+    /* Start a new capture.  The file must not exist yet; it is created
+     * readable by its owner only and never replaces another file. */
+    bool open(const char *path, char *err, size_t errLen);
+    void close();
+    bool isOpen() const { return active; }
+
+    /* True once a write has failed and recording stopped; cleared by open(). */
+    bool failed() const { return writeFailed; }
+
+    /* Safe from any thread; does nothing unless open. */
+    void record(int link, SiTechCaptureDirection direction, const char *data, size_t len, double time);
+
+    uint64_t recorded() const { return bytes; }
+
+private:
+    std::mutex lock;
+    FILE *fp;
+    char *buffer;
+    std::atomic<bool> active;
+    std::atomic<bool> writeFailed;
+    std::atomic<uint64_t> bytes;
+    double lastFlush;
+};
+
+class SiTechCaptureReader
+{
+public:
+    SiTechCaptureReader();
+    ~SiTechCaptureReader();
+
+    bool open(const char *path, char *err, size_t errLen);
+    void close();
+    double startTime() const { return header.startTime; }
+
+    /* Next record; data gets its bytes, up to dataLen.  False at the end. */
+    bool next(SiTechCaptureRecord *rec, char *data, size_t dataLen);
+
+private:
+    FILE *fp;
+    SiTechCaptureHeader header;
+};
+
+#endif // SITECH_CAPTURE_H
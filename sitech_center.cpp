@@ -0,0 +1,161 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sitech_center.h"
+
+#define SIDEREAL_ARCSEC     15.041067       /* arcsec/s */
+#define CENTER_MIN_COS      0.02            /* keep RA moves finite near the pole */
+
+SiTechCenterMove SiTechPlanCenterMove(double raArcsec, double decArcsec, double dec,
+                                      double guideRateRA, double guideRateDec,
+                                      double roundTrip, const SiTechSlewHistory &slews)
+{
+    SiTechCenterMove move;
+    double c = cos(dec * M_PI / 180.0);
+    if (c < CENTER_MIN_COS) c = CENTER_MIN_COS;
+
+    move.raArcsec   = raArcsec / c;
+    move.decArcsec  = decArcsec;
+    move.raHours    = move.raArcsec / (15.0 * 3600.0);
+    move.decDegrees = decArcsec / 3600.0;
+    move.distance   = fabs(move.raHours * 15.0) > fabs(move.decDegrees) ? fabs(move.raHours * 15.0) : fabs(move.decDegrees);
+    double offsetSeconds = slews.estimate(move.distance);
+
+    // Both jogs go out together and the axes move at once
+    double raTime  = (guideRateRA > 0) ? fabs(move.raArcsec) / (guideRateRA * SIDEREAL_ARCSEC) : HUGE_VAL;
+    double decTime = (guideRateDec > 0) ? fabs(move.decArcsec) / (guideRateDec * SIDEREAL_ARCSEC) : HUGE_VAL;
+    double jogTime = raTime > decTime ? raTime : decTime;
+
+    // Either way the command reaches the mount half a round trip after it is sent
+    move.method = (jogTime <= offsetSeconds) ? CENTER_JOG : CENTER_OFFSET;
+    move.expectedSeconds = roundTrip / 2 + ((move.method == CENTER_JOG) ? jogTime : offsetSeconds);
+    return move;
+}
+
+SiTechCenterer::SiTechCenterer()
+{
+    current = CENTER_IDLE;
+    tolerance = 0;
+    maxMoves = 0;
+    moves = 0;
+    error = 0;
+    startTime = 0;
+    sentTime = 0;
+    expected = 0;
+    sawMotion = false;
+    failReason[0] = 0;
+}
+
+void SiTechCenterer::start(double toleranceArcsec, int maxIterations, double now)
+{
+    current = CENTER_MEASURING;
+    tolerance = toleranceArcsec;
+    maxMoves = maxIterations;
+    moves = 0;
+    error = 0;
+    startTime = now;
+    sentTime = 0;
+    expected = 0;
+    sawMotion = false;
+    failReason[0] = 0;
+}
+
+void SiTechCenterer::stop()
+{
+    if (isActive()) current = CENTER_IDLE;
+}
+
+void SiTechCenterer::fail(const char *why)
+{
+    current = CENTER_FAILED;
+    strncpy(failReason, why, sizeof(failReason) - 1);
+    failReason[sizeof(failReason) - 1] = 0;
+}
+
+bool SiTechCenterer::measured(double raArcsec, double decArcsec)
+{
+    if (current != CENTER_MEASURING) return false;
+
+    double previous = error;
+    error = sqrt(raArcsec * raArcsec + decArcsec * decArcsec);
+
+    if (error <= tolerance)
+    {
+        current = CENTER_DONE;
+        return false;
+    }
+
+    char why[128];
+    // A wrong sign or swapped axes in the measurement makes every move worse
+    if (moves > 0 && error > previous * CENTER_DIVERGENCE)
+    {
+        snprintf(why, sizeof(why), "error grew from %.1f\" to %.1f\"", previous, error);
+        fail(why);
+        return false;
+    }
+    if (moves >= maxMoves)
+    {
+        snprintf(why, sizeof(why), "still %.1f\" off after %d corrections", error, moves);
+        fail(why);
+        return false;
+    }
+    return true;
+}
+
+void SiTechCenterer::moveSent(double sendTime, double expectedSeconds)
+{
+    if (current != CENTER_MEASURING) return;
+    current = CENTER_MOVING;
+    moves++;
+    sentTime = sendTime;
+    expected = expectedSeconds;
+    sawMotion = false;
+}
+
+bool SiTechCenterer::update(int statusBits, double sampleTime)
+{
+    if (current != CENTER_MOVING) return false;
+
+    // Anything polled before the command went out says nothing about the move
+    if (sampleTime <= sentTime) return false;
+
+    if (statusBits & (SITECH_STT_PARKED | SITECH_STT_BLINKY | SITECH_STT_COMM_BAD | SITECH_STT_LIMITS))
+    {
+        fail("mount stopped during the correction");
+        return false;
+    }
+
+    double since = sampleTime - sentTime;
+    if (statusBits & SITECH_STT_SLEWING)
+    {
+        sawMotion = true;
+        if (since > expected + CENTER_MOVE_TIMEOUT) fail("correction did not settle");
+        return false;
+    }
+
+    // Jogs may never raise the slewing bit; then wait until it should be done
+    if (!sawMotion && since < expected)
+        return false;
+
+    current = CENTER_MEASURING;
+    return true;
+}
@@ -0,0 +1,119 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Closed-loop centering.
+ *
+ * A centering run alternates between measuring how far the target is from
+ * where the telescope points (a plate solver, or a client) and correcting.
+ * Each correction is either a pair of JogArcSeconds on the two axes, which
+ * move at about the guide rate, or one OffsetDestinationBy, which is a short
+ * slew and pays the mount's settle time.  The cheaper of the two is used.
+ *
+ * A move counts as finished from the status bits: once the slewing bit has
+ * come and gone, or, for jogs that never raise it, once the slewing bit is
+ * clear and the jog should be over.  Only status samples taken after the
+ * command was sent are looked at.
+ *
+ * Offsets are on the sky in arcseconds, positive when the target lies east
+ * (larger RA) or north of where the telescope points.
+ */
+
+#ifndef SITECH_CENTER_H
+#define SITECH_CENTER_H
+
+#include "sitech_protocol.h"
+#include "sitech_slew.h"
+
+#define CENTER_DIVERGENCE       1.5             /* give up when a correction makes the error this much worse */
+#define CENTER_MOVE_TIMEOUT     60              /* seconds a move may overrun its estimate */
+
+enum SiTechCenterMethod
+{
+    CENTER_JOG,             /* JogArcSeconds E/W and N/S */
+    CENTER_OFFSET           /* OffsetDestinationBy */
+};
+
+enum SiTechCenterState
+{
+    CENTER_IDLE,
+    CENTER_MEASURING,       /* waiting for an offset */
+    CENTER_MOVING,          /* correction sent, waiting for the mount to settle */
+    CENTER_DONE,
+    CENTER_FAILED
+};
+
+struct SiTechCenterMove
+{
+    SiTechCenterMethod method;
+    double raArcsec;        /* RA axis arcseconds, + east */
+    double decArcsec;       /* + north */
+    double raHours;         /* the same move for OffsetDestinationBy */
+    double decDegrees;
+    double distance;        /* larger axis move, degrees */
+    double expectedSeconds; /* from sending the command to the end of the move */
+};
+
+/* Size a correction for an on-sky offset at declination dec (degrees).  Guide
+ * rates are fractions of sidereal, roundTrip is the link round trip and the
+ * slew history says what a short slew costs, settle included. */
+SiTechCenterMove SiTechPlanCenterMove(double raArcsec, double decArcsec, double dec,
+                                      double guideRateRA, double guideRateDec,
+                                      double roundTrip, const SiTechSlewHistory &slews);
+
+class SiTechCenterer
+{
+public:
+    SiTechCenterer();
+
+    /* Times are host seconds, status sample times for update(). */
+    void start(double tolerance, int maxIterations, double now);
+    void stop();
+    void fail(const char *why);
+
+    /* A measured offset.  True when a correction should be sent; otherwise
+     * the run is over, DONE or FAILED. */
+    bool measured(double raArcsec, double decArcsec);
+    void moveSent(double sendTime, double expectedSeconds);
+
+    /* A status sample.  True once the move has settled and the next
+     * measurement is wanted. */
+    bool update(int statusBits, double sampleTime);
+
+    SiTechCenterState state() const { return current; }
+    bool isActive() const { return current == CENTER_MEASURING || current == CENTER_MOVING; }
+    int iterations() const { return moves; }
+    double lastError() const { return error; }
+    double elapsed(double now) const { return now - startTime; }
+    bool sawSlew() const { return sawMotion; }
+    double moveStart() const { return sentTime; }
+    const char *reason() const { return failReason; }
+
+private:
+    SiTechCenterState current;
+    double tolerance;
+    int maxMoves;
+    int moves;
+    double error;
+    double startTime;
+    double sentTime;
+    double expected;
+    bool sawMotion;
+    char failReason[128];
+};
+
+#endif // SITECH_CENTER_H
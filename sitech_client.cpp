@@ -0,0 +1,341 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "sitech_client.h"
+
+#define CLIENT_MAX_BATCH    8
+
+SiTechClient::SiTechClient()
+{
+    running = false;
+    streaming = false;
+    haveLatest = false;
+    lastStreamError = SITECH_OK;
+    memset(&latest, 0, sizeof(latest));
+
+    // Written after every status poll, so an event loop can wait on it
+    if (pipe(wakeFd) == 0)
+    {
+        fcntl(wakeFd[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakeFd[1], F_SETFL, O_NONBLOCK);
+    }
+    else
+        wakeFd[0] = wakeFd[1] = -1;
+}
+
+SiTechClient::~SiTechClient()
+{
+    disconnect();
+    if (wakeFd[0] >= 0) close(wakeFd[0]);
+    if (wakeFd[1] >= 0) close(wakeFd[1]);
+}
+
+bool SiTechClient::connect(const char *host, int port, char *err, size_t errLen)
+{
+    disconnect();
+    if (!link.openMainLink(host, port, err, errLen)) return false;
+    startWorkers();
+    return true;
+}
+
+void SiTechClient::attach(int fd)
+{
+    disconnect();
+    link.attach(fd);
+    startWorkers();
+}
+
+void SiTechClient::disconnect()
+{
+    stopStatusStream();
+    stopWorkers();
+    link.closePriorityLink();
+    link.closeMainLink();
+    {
+        std::lock_guard<std::mutex> guard(latestLock);
+        haveLatest = false;
+        lastStreamError = SITECH_OK;
+    }
+    std::lock_guard<std::mutex> guard(clockLock);
+    estimate.reset();
+}
+
+SiTechClockEstimator SiTechClient::clock()
+{
+    std::lock_guard<std::mutex> guard(clockLock);
+    return estimate;
+}
+
+void SiTechClient::startWorkers()
+{
+    running = true;
+    for (int i = 0; i < LANE_COUNT; i++)
+        workers[i].thread = std::thread(&SiTechClient::work, this, (SiTechLane) i);
+}
+
+void SiTechClient::stopWorkers()
+{
+    if (!running) return;
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        {
+            std::lock_guard<std::mutex> guard(workers[i].lock);
+            running = false;
+        }
+        workers[i].cv.notify_all();
+    }
+    for (int i = 0; i < LANE_COUNT; i++)
+        if (workers[i].thread.joinable()) workers[i].thread.join();
+}
+
+void SiTechClient::work(SiTechLane lane)
+{
+    Worker &w = workers[lane];
+    std::unique_lock<std::mutex> guard(w.lock);
+    while (true)
+    {
+        w.cv.wait(guard, [this, &w] { return !running || !w.queue.empty(); });
+        if (w.queue.empty()) break;
+
+        Request request = std::move(w.queue.front());
+        w.queue.pop_front();
+        guard.unlock();
+
+        if (running)
+            request.promise.set_value(execute(lane, request.command.c_str()));
+        else
+        {
+            // Shutting down: whatever is still queued is not sent
+            SiTechReply reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.error = SITECH_NOT_CONNECTED;
+            request.promise.set_value(reply);
+        }
+        guard.lock();
+    }
+}
+
+SiTechReply SiTechClient::execute(SiTechLane lane, const char *command)
+{
+    SiTechReply reply;
+    memset(&reply, 0, sizeof(reply));
+    char *text = reply.text;
+
+    reply.error = link.transact(lane, command, text, sizeof(reply.text), &reply.sendTime, &reply.receiveTime);
+    finish(command, text, reply);
+    return reply;
+}
+
+int SiTechClient::executeBatch(SiTechLane lane, const char *const *commands, int count, SiTechReply *replies)
+{
+    if (count > CLIENT_MAX_BATCH) return 0;
+    char *texts[CLIENT_MAX_BATCH];
+    int results[CLIENT_MAX_BATCH];
+    double sent, received;
+    for (int i = 0; i < count; i++)
+    {
+        memset(&replies[i], 0, sizeof(replies[i]));
+        texts[i] = replies[i].text;
+    }
+
+    link.transactBatch(lane, commands, count, texts, SITECH_REPLY_LEN, &sent, &received, results);
+    int got = 0;
+    for (int i = 0; i < count; i++)
+    {
+        replies[i].error = results[i];
+        replies[i].sendTime = sent;
+        replies[i].receiveTime = received;
+        finish(commands[i], texts[i], replies[i]);
+        if (results[i] == SITECH_OK) got++;
+    }
+    return got;
+}
+
+/* Parse a reply and take its clock sample. */
+void SiTechClient::finish(const char *command, const char *text, SiTechReply &reply)
+{
+    reply.sampleTime = reply.sendTime + (reply.receiveTime - reply.sendTime) / 2;
+    if (reply.error != SITECH_OK) return;
+
+    SiTechParseStatus(text, &reply.status);
+
+    // Accepted when the message names the command, i.e. its first word
+    char name[64];
+    size_t n = strcspn(command, " ");
+    if (n >= sizeof(name)) n = sizeof(name) - 1;
+    memcpy(name, command, n);
+    name[n] = '\0';
+    reply.accepted = reply.status.answers(name);
+
+    if (reply.status.julianDay > 0)
+    {
+        std::lock_guard<std::mutex> guard(clockLock);
+        reply.sampleTime = estimate.addSample(reply.sendTime, reply.receiveTime,
+                                              SiTechMountTime(reply.status.julianDay, reply.status.scopeTime));
+    }
+}
+
+std::future<SiTechReply> SiTechClient::submit(const char *command)
+{
+    SiTechLane lane = SiTechLaneFor(command);
+    Worker &w = workers[lane];
+    Request request;
+    request.command = command;
+    std::future<SiTechReply> result = request.promise.get_future();
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (!running)
+        {
+            SiTechReply reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.error = SITECH_NOT_CONNECTED;
+            request.promise.set_value(reply);
+            return result;
+        }
+        w.queue.push_back(std::move(request));
+    }
+    w.cv.notify_one();
+    return result;
+}
+
+std::future<SiTechReply> SiTechClient::send(const char *command)
+{
+    return submit(command);
+}
+
+std::future<SiTechReply> SiTechClient::readStatus()
+{
+    return submit(SITECH_CMD_STATUS);
+}
+
+std::future<SiTechReply> SiTechClient::goTo(double ra, double dec, bool j2000)
+{
+    char cmd[64];
+    SiTechEncodeGoTo(cmd, sizeof(cmd), ra, dec, j2000);
+    return submit(cmd);
+}
+
+std::future<SiTechReply> SiTechClient::goToAltAz(double az, double alt)
+{
+    char cmd[64];
+    SiTechEncodeGoToAltAz(cmd, sizeof(cmd), az, alt);
+    return submit(cmd);
+}
+
+std::future<SiTechReply> SiTechClient::sync(double ra, double dec, int mode)
+{
+    char cmd[64];
+    SiTechEncodeSync(cmd, sizeof(cmd), ra, dec, mode);
+    return submit(cmd);
+}
+
+std::future<SiTechReply> SiTechClient::park(int mode)
+{
+    char cmd[64];
+    SiTechEncodePark(cmd, sizeof(cmd), mode);
+    return submit(cmd);
+}
+
+std::future<SiTechReply> SiTechClient::unpark()
+{
+    return submit(SITECH_CMD_UNPARK);
+}
+
+std::future<SiTechReply> SiTechClient::abort()
+{
+    return submit(SITECH_CMD_ABORT);
+}
+
+std::future<SiTechReply> SiTechClient::pulseGuide(SiTechGuideDirection direction, int milliseconds)
+{
+    char cmd[64];
+    SiTechEncodePulseGuide(cmd, sizeof(cmd), direction, milliseconds);
+    return submit(cmd);
+}
+
+std::future<SiTechReply> SiTechClient::setTracking(bool track, bool useRates, double raRate, double decRate)
+{
+    char cmd[96];
+    SiTechEncodeSetTrackMode(cmd, sizeof(cmd), track, useRates, raRate, decRate);
+    return submit(cmd);
+}
+
+bool SiTechClient::startStatusStream(int periodMs, SiTechStatusCallback callback)
+{
+    if (periodMs <= 0 || !isConnected()) return false;
+    stopStatusStream();
+    streaming = true;
+    stream = std::thread(&SiTechClient::streamStatus, this, periodMs, callback);
+    return true;
+}
+
+void SiTechClient::stopStatusStream()
+{
+    {
+        std::lock_guard<std::mutex> guard(latestLock);
+        if (!streaming && !stream.joinable()) return;
+        streaming = false;
+    }
+    streamCv.notify_all();
+    if (stream.joinable()) stream.join();
+}
+
+void SiTechClient::streamStatus(int periodMs, SiTechStatusCallback callback)
+{
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(latestLock);
+    while (streaming)
+    {
+        guard.unlock();
+        SiTechReply reply = execute(LANE_TELEMETRY, SITECH_CMD_STATUS);
+        if (callback) callback(reply);
+        guard.lock();
+        lastStreamError = reply.error;
+        if (reply.error == SITECH_OK)
+        {
+            latest = reply;
+            haveLatest = true;
+        }
+        if (wakeFd[1] >= 0)
+        {
+            // A full pipe already says there is something to read
+            char c = 0;
+            ssize_t n = write(wakeFd[1], &c, 1);
+            (void) n;
+        }
+
+        // Fixed rate, not fixed gap: a slow reply does not push the later polls back
+        next += std::chrono::milliseconds(periodMs);
+        if (next < std::chrono::steady_clock::now()) next = std::chrono::steady_clock::now();
+        streamCv.wait_until(guard, next, [this] { return !streaming; });
+    }
+}
+
+bool SiTechClient::latestStatus(SiTechReply *out)
+{
+    std::lock_guard<std::mutex> guard(latestLock);
+    if (!haveLatest) return false;
+    *out = latest;
+    return true;
+}
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* In-process SiTechExe client, no INDI involved.
+ *
+ * Commands return futures.  Each lane of the transport has its own worker
+ * thread, so requests on one lane run in the order they were made, an Abort
+ * never queues behind a GoTo, and the transport serves the lanes by priority.
+ * Every reply is a status frame; it is parsed, and fed to a clock estimate so
+ * each one carries the host time of its exchange midpoint.
+ *
+ * A status stream polls ReadScopeStatus at a fixed period on its own thread
+ * and hands every frame to a callback; latestStatus() returns the last one
+ * without touching the link.  For an event loop, statusFd() becomes readable
+ * after every poll: read it empty, then take latestStatus().
+ */
+
+#ifndef SITECH_CLIENT_H
+#define SITECH_CLIENT_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "sitech_clock.h"
+#include "sitech_protocol.h"
+#include "sitech_transport.h"
+
+#define SITECH_REPLY_LEN    512
+
+struct SiTechReply
+{
+    int error;              /* SiTechLinkError */
+    bool accepted;          /* no link error and the message names the command */
+    SiTechStatus status;
+    double sendTime;        /* host, CLOCK_REALTIME seconds */
+    double receiveTime;
+    double sampleTime;      /* exchange midpoint */
+    char text[SITECH_REPLY_LEN];    /* the reply line, empty on error */
+};
+
+typedef std::function<void (const SiTechReply &)> SiTechStatusCallback;
+
+class SiTechClient
+{
+public:
+    SiTechClient();
+    ~SiTechClient();
+
+    /* Connect to SiTechExe, or use a connection made elsewhere (not closed here). */
+    bool connect(const char *host, int port, char *err, size_t errLen);
+    void attach(int fd);
+    void disconnect();
+    bool isConnected() const { return link.isAttached(); }
+
+    SiTechTransport &transport() { return link; }
+    SiTechClockEstimator clock();
+
+    std::future<SiTechReply> readStatus();
+    std::future<SiTechReply> goTo(double ra, double dec, bool j2000 = false);
+    std::future<SiTechReply> goToAltAz(double az, double alt);
+    std::future<SiTechReply> sync(double ra, double dec, int mode = 0);
+    std::future<SiTechReply> park(int mode = 0);
+    std::future<SiTechReply> unpark();
+    std::future<SiTechReply> abort();
+    std::future<SiTechReply> pulseGuide(SiTechGuideDirection direction, int milliseconds);
+    std::future<SiTechReply> setTracking(bool track, bool useRates = false, double raRate = 0, double decRate = 0);
+
+    /* Any other command line, on the lane SiTechLaneFor() gives it. */
+    std::future<SiTechReply> send(const char *command);
+
+    /* Blocking exchange on the calling thread. */
+    SiTechReply execute(SiTechLane lane, const char *command);
+
+    /* Blocking pipelined exchange, replies[i] answers commands[i].  Returns
+     * how many replies arrived; they come in order, so it is always the first
+     * ones, and the rest carry the error. */
+    int executeBatch(SiTechLane lane, const char *const *commands, int count, SiTechReply *replies);
+
+    /* Poll the status every periodMs on a thread of its own.  The callback
+     * runs on that thread and may be empty. */
+    bool startStatusStream(int periodMs, SiTechStatusCallback callback);
+    void stopStatusStream();
+    bool latestStatus(SiTechReply *out);
+    int statusFd() const { return wakeFd[0]; }
+    int streamError() const { return lastStreamError; }     /* of the last poll, SITECH_OK if it was answered */
+
+private:
+    struct Request
+    {
+        std::string command;
+        std::promise<SiTechReply> promise;
+    };
+    struct Worker
+    {
+        std::thread thread;
+        std::deque<Request> queue;
+        std::mutex lock;
+        std::condition_variable cv;
+    };
+
+    std::future<SiTechReply> submit(const char *command);
+    void finish(const char *command, const char *text, SiTechReply &reply);
+    void startWorkers();
+    void stopWorkers();
+    void work(SiTechLane lane);
+    void streamStatus(int periodMs, SiTechStatusCallback callback);
+
+    SiTechTransport link;
+    Worker workers[LANE_COUNT];
+    std::atomic<bool> running;
+
+    std::mutex clockLock;
+    SiTechClockEstimator estimate;
+
+    std::thread stream;
+    std::atomic<bool> streaming;
+    std::mutex latestLock;
+    std::condition_variable streamCv;
+    SiTechReply latest;
+    bool haveLatest;
+    std::atomic<int> lastStreamError;
+    int wakeFd[2];
+};
+
+#endif // SITECH_CLIENT_H
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+#include <time.h>
+
+#include "sitech_clock.h"
+
+#define JD_UNIX_EPOCH       2440587.5
+#define SECONDS_PER_DAY     86400.0
+#define MAX_DRIFT           200e-6          /* clamp the fitted drift to a sane crystal error */
+
+double SiTechHostTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double SiTechMountTime(double julianDay, double scopeTimeHours)
+{
+    double t = (julianDay - JD_UNIX_EPOCH) * SECONDS_PER_DAY;
+
+    // The Julian day is printed with limited decimals.  When the scope time
+    // agrees with the Julian day's UT time of day, use it for the fraction.
+    double dayStart = floor(t / SECONDS_PER_DAY) * SECONDS_PER_DAY;
+    double fromScopeTime = dayStart + scopeTimeHours * 3600.0;
+    if (fromScopeTime - t > SECONDS_PER_DAY / 2) fromScopeTime -= SECONDS_PER_DAY;
+    if (t - fromScopeTime > SECONDS_PER_DAY / 2) fromScopeTime += SECONDS_PER_DAY;
+    if (fabs(fromScopeTime - t) < 60) return fromScopeTime;
+
+    return t;
+}
+
+SiTechClockEstimator::SiTechClockEstimator()
+{
+    reset();
+}
+
+void SiTechClockEstimator::reset()
+{
+    filterCount = 0;
+    fitCount = 0;
+    fitNext = 0;
+    epoch = 0;
+    intercept = 0;
+    slope = 0;
+    lastRtt = 0;
+    minRtt = 0;
+    lastMid = 0;
+}
+
+double SiTechClockEstimator::addSample(double hostSend, double hostReceive, double mountTime)
+{
+    double rtt = hostReceive - hostSend;
+    if (rtt < 0) rtt = 0;
+    double mid = hostSend + rtt / 2;
+
+    lastRtt = rtt;
+    lastMid = mid;
+    if (minRtt == 0 || rtt < minRtt) minRtt = rtt;
+
+    filterMid[filterCount]    = mid;
+    filterOffset[filterCount] = mountTime - mid;
+    filterRtt[filterCount]    = rtt;
+    filterCount++;
+
+    // The first sample seeds the estimate so it is usable right away
+    if (fitCount == 0 || filterCount == CLOCK_FILTER_SIZE)
+    {
+        int best = 0;
+        for (int i = 1; i < filterCount; i++)
+            if (filterRtt[i] < filterRtt[best]) best = i;
+
+        fitMid[fitNext]    = filterMid[best];
+        fitOffset[fitNext] = filterOffset[best];
+        fitNext = (fitNext + 1) % CLOCK_FIT_SIZE;
+        if (fitCount < CLOCK_FIT_SIZE) fitCount++;
+        if (filterCount == CLOCK_FILTER_SIZE) filterCount = 0;
+
+        fit();
+    }
+
+    return mid;
+}
+
+void SiTechClockEstimator::fit()
+{
+    // Least squares offset = intercept + slope * (t - epoch), epoch = newest sample
+    int newest = (fitNext + CLOCK_FIT_SIZE - 1) % CLOCK_FIT_SIZE;
+    epoch = fitMid[newest];
+
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < fitCount; i++)
+    {
+        double x = fitMid[i] - epoch;
+        double y = fitOffset[i];
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double n = fitCount;
+    double den = n * sxx - sx * sx;
+    if (fitCount < 3 || den <= 0)
+    {
+        slope = 0;
+        intercept = sy / n;
+        return;
+    }
+    slope = (n * sxy - sx * sy) / den;
+    if (slope > MAX_DRIFT) slope = MAX_DRIFT;
+    if (slope < -MAX_DRIFT) slope = -MAX_DRIFT;
+    intercept = (sy - slope * sx) / n;
+}
+
+double SiTechClockEstimator::offsetAt(double hostTime) const
+{
+    return intercept + slope * (hostTime - epoch);
+}
+
+double SiTechClockEstimator::mountToHost(double mountTime) const
+{
+    // mount = host + intercept + slope * (host - epoch)
+    return (mountTime - intercept + slope * epoch) / (1 + slope);
+}
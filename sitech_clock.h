@@ -0,0 +1,87 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Host <-> SiTechExe clock estimation.
+ *
+ * Every exchange gives a send time and a receive time on the host clock and
+ * the mount time carried in the reply (Julian day, refined by the scope time
+ * of day when it is UT).  Like NTP, the mount time is assumed to belong to the
+ * midpoint of the exchange.  Of every CLOCK_FILTER_SIZE samples the one with the
+ * shortest round trip is kept, and offset and drift are fitted over the last
+ * CLOCK_FIT_SIZE kept samples.
+ */
+
+#ifndef SITECH_CLOCK_H
+#define SITECH_CLOCK_H
+
+#define CLOCK_FILTER_SIZE   8
+#define CLOCK_FIT_SIZE      64
+
+/* CLOCK_REALTIME in seconds. */
+double SiTechHostTime();
+
+/* Mount time in unix seconds from the status frame Julian day and scope time (hours). */
+double SiTechMountTime(double julianDay, double scopeTimeHours);
+
+class SiTechClockEstimator
+{
+public:
+    SiTechClockEstimator();
+
+    void reset();
+
+    /* One request/reply exchange.  Returns the host time of the sample (exchange midpoint). */
+    double addSample(double hostSend, double hostReceive, double mountTime);
+
+    bool isValid() const { return fitCount > 0; }
+
+    /* Mount clock minus host clock at a host time, seconds. */
+    double offsetAt(double hostTime) const;
+    double hostToMount(double hostTime) const { return hostTime + offsetAt(hostTime); }
+    double mountToHost(double mountTime) const;
+
+    double drift() const { return slope; }          /* seconds per second */
+    double lastRoundTrip() const { return lastRtt; }
+    double minRoundTrip() const { return minRtt; }
+    double lastMidpoint() const { return lastMid; }
+
+private:
+    void fit();
+
+    // Clock filter: raw samples, the minimum round trip one is promoted
+    double filterMid[CLOCK_FILTER_SIZE];
+    double filterOffset[CLOCK_FILTER_SIZE];
+    double filterRtt[CLOCK_FILTER_SIZE];
+    int filterCount;
+
+    // Promoted samples for the offset/drift fit
+    double fitMid[CLOCK_FIT_SIZE];
+    double fitOffset[CLOCK_FIT_SIZE];
+    int fitCount;
+    int fitNext;
+
+    double epoch;           /* fit reference time */
+    double intercept;       /* offset at epoch */
+    double slope;
+
+    double lastRtt;
+    double minRtt;
+    double lastMid;
+};
+
+#endif // SITECH_CLOCK_H
@@ -0,0 +1,194 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "sitech_horizon.h"
+
+#define DEG2RAD             (M_PI / 180.0)
+#define RAD2DEG             (180.0 / M_PI)
+#define SIDEREAL_TO_SOLAR   0.99726956633                   /* solar seconds per sidereal second */
+#define MASK_SEARCH_STEP    (2.0 / 60.0)                    /* coarse search step, hours */
+
+SiTechHorizonMask::SiTechHorizonMask()
+{
+    clear();
+}
+
+void SiTechHorizonMask::clear()
+{
+    for (int i = 0; i < HORIZON_GRID_SIZE; i++)
+        limits[i] = 0;
+    minLimit = 0;
+    maxLimit = 0;
+    loaded = false;
+}
+
+bool SiTechHorizonMask::load(const char *path, char *err, size_t errLen)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        snprintf(err, errLen, "Cannot open %s", path);
+        return false;
+    }
+
+    std::vector<std::pair<double, double> > points;
+    char line[256];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        lineNo++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        double az, alt;
+        int n = sscanf(line, "%lf %lf", &az, &alt);
+        if (n == EOF) continue;             // blank or comment-only line
+        if (n != 2 || alt < -90 || alt > 90)
+        {
+            snprintf(err, errLen, "%s line %d: expected \"azimuth altitude\"", path, lineNo);
+            fclose(fp);
+            return false;
+        }
+        az = fmod(az, 360.0);
+        if (az < 0) az += 360.0;
+        points.push_back(std::make_pair(az, alt));
+    }
+    fclose(fp);
+
+    if (points.empty())
+    {
+        snprintf(err, errLen, "%s has no horizon points", path);
+        return false;
+    }
+
+    std::sort(points.begin(), points.end());
+
+    // Linear interpolation between neighbours, wrapping from the last point through north to the first
+    size_t n = points.size();
+    double lo = 90, hi = -90;
+    for (int i = 0; i < HORIZON_GRID_SIZE; i++)
+    {
+        double az = i * HORIZON_GRID_STEP;
+        double alt;
+        if (n == 1)
+            alt = points[0].second;
+        else
+        {
+            size_t j = 0;
+            while (j < n && points[j].first <= az) j++;
+            const std::pair<double, double> &a = points[(j + n - 1) % n];
+            const std::pair<double, double> &b = points[j % n];
+            double span = b.first - a.first;
+            if (span <= 0) span += 360.0;
+            double d = az - a.first;
+            if (d < 0) d += 360.0;
+            alt = (span > 0) ? a.second + (b.second - a.second) * d / span : a.second;
+        }
+        limits[i] = (float) alt;
+        lo = std::min(lo, alt);
+        hi = std::max(hi, alt);
+    }
+    minLimit = lo;
+    maxLimit = hi;
+    loaded = true;
+    return true;
+}
+
+double SiTechHorizonMask::limitAt(double az) const
+{
+    az = fmod(az, 360.0);
+    if (az < 0) az += 360.0;
+    int i = (int) (az / HORIZON_GRID_STEP + 0.5);
+    if (i >= HORIZON_GRID_SIZE) i -= HORIZON_GRID_SIZE;
+    return limits[i];
+}
+
+void SiTechEquToHorizontal(double haHours, double decDeg, double latDeg, double *altDeg, double *azDeg)
+{
+    double ha  = haHours * 15.0 * DEG2RAD;
+    double dec = decDeg * DEG2RAD;
+    double lat = latDeg * DEG2RAD;
+
+    double sinAlt = sin(lat) * sin(dec) + cos(lat) * cos(dec) * cos(ha);
+    if (sinAlt > 1) sinAlt = 1;
+    if (sinAlt < -1) sinAlt = -1;
+    *altDeg = asin(sinAlt) * RAD2DEG;
+
+    // Azimuth from north through east
+    double y = -cos(dec) * sin(ha);
+    double x = sin(dec) * cos(lat) - cos(dec) * cos(ha) * sin(lat);
+    double az = atan2(y, x) * RAD2DEG;
+    if (az < 0) az += 360.0;
+    *azDeg = az;
+}
+
+double SiTechNormalizeHA(double haHours)
+{
+    haHours = fmod(haHours, 24.0);
+    if (haHours < -12) haHours += 24.0;
+    if (haHours >= 12) haHours -= 24.0;
+    return haHours;
+}
+
+static bool aboveMask(const SiTechHorizonMask &mask, double haHours, double decDeg, double latDeg)
+{
+    double alt, az;
+    SiTechEquToHorizontal(haHours, decDeg, latDeg, &alt, &az);
+    return mask.isAbove(alt, az);
+}
+
+double SiTechTimeUntilBelowMask(const SiTechHorizonMask &mask, double haHours, double decDeg, double latDeg, double maxHours)
+{
+    if (!aboveMask(mask, haHours, decDeg, latDeg)) return 0;
+
+    // Coarse steps in sidereal time, then bisect the step where it crosses
+    double maxSidereal = maxHours / SIDEREAL_TO_SOLAR;
+    double t0 = 0;
+    for (double t = MASK_SEARCH_STEP; t <= maxSidereal + MASK_SEARCH_STEP / 2; t += MASK_SEARCH_STEP)
+    {
+        if (!aboveMask(mask, haHours + t, decDeg, latDeg))
+        {
+            double a = t0, b = t;
+            for (int i = 0; i < 12; i++)
+            {
+                double m = (a + b) / 2;
+                if (aboveMask(mask, haHours + m, decDeg, latDeg)) a = m; else b = m;
+            }
+            return b * SIDEREAL_TO_SOLAR;
+        }
+        t0 = t;
+    }
+    return -1;
+}
+
+double SiTechTimeUntilFlip(double haHours, double flipHAHours, bool isLookingEast)
+{
+    if (!isLookingEast) return -1;
+    double remaining = flipHAHours - SiTechNormalizeHA(haHours);
+    if (remaining < 0) remaining = 0;
+    return remaining * SIDEREAL_TO_SOLAR;
+}
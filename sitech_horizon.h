@@ -0,0 +1,80 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Horizon mask and meridian flip prediction.
+ *
+ * The mask file is plain text, one "azimuth altitude" pair in degrees per
+ * line, '#' starts a comment.  Azimuth is 0 = north, 90 = east, as SiTechExe
+ * uses it.  Points are interpolated linearly (wrapping through north) into a
+ * fixed azimuth grid, so a lookup is one array index.
+ */
+
+#ifndef SITECH_HORIZON_H
+#define SITECH_HORIZON_H
+
+#include <stddef.h>
+
+#define HORIZON_GRID_STEP   0.25                            /* degrees of azimuth per grid cell */
+#define HORIZON_GRID_SIZE   ((int) (360.0 / HORIZON_GRID_STEP))
+
+class SiTechHorizonMask
+{
+public:
+    SiTechHorizonMask();
+
+    /* Load a mask file.  On failure the previous mask is kept and err says why. */
+    bool load(const char *path, char *err, size_t errLen);
+    void clear();
+
+    bool isLoaded() const { return loaded; }
+
+    /* Minimum altitude at an azimuth, degrees. */
+    double limitAt(double az) const;
+    bool isAbove(double alt, double az) const { return alt >= limitAt(az); }
+
+    double lowestLimit() const { return minLimit; }
+    double highestLimit() const { return maxLimit; }
+    const float *grid() const { return limits; }
+
+private:
+    float limits[HORIZON_GRID_SIZE];
+    double minLimit;
+    double maxLimit;
+    bool loaded;
+};
+
+/* Hour angle (hours) and declination (degrees) to altitude/azimuth (degrees). */
+void SiTechEquToHorizontal(double haHours, double decDeg, double latDeg, double *altDeg, double *azDeg);
+
+/* Hour angle normalised to -12..+12 hours. */
+double SiTechNormalizeHA(double haHours);
+
+/* Solar hours from now until a tracked target (hour angle, dec) drops below
+ * the mask, searching up to maxHours ahead.  0 if already below, -1 if it stays
+ * above for the whole search. */
+double SiTechTimeUntilBelowMask(const SiTechHorizonMask &mask, double haHours, double decDeg, double latDeg, double maxHours);
+
+/* Solar hours until a tracked target on a GEM reaches flipHAHours past the
+ * meridian.  Only meaningful when the scope is looking east (hour angle < 0
+ * side); -1 when no flip is pending. */
+double SiTechTimeUntilFlip(double haHours, double flipHAHours, bool isLookingEast);
+
+/* Pier side SiTechExe will choose for a target: true if it will be "looking east". */
+inline bool SiTechPredictLookingEast(double haHours) { return SiTechNormalizeHA(haHours) < 0; }
+
+#endif // SITECH_HORIZON_H
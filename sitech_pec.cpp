@@ -0,0 +1,227 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "sitech_pec.h"
+
+#define PE_BINS         (PE_WINDOW / 2 + 1)
+#define PE_MIN_BIN      2                   /* bins 0 and 1 are drift and window-length leakage */
+
+SiTechTrackingAnalyzer::SiTechTrackingAnalyzer()
+{
+    for (int n = 0; n < PE_WINDOW; n++)
+    {
+        twCos[n] = cos(2 * M_PI * n / PE_WINDOW);
+        twSin[n] = sin(2 * M_PI * n / PE_WINDOW);
+    }
+    reset();
+}
+
+void SiTechTrackingAnalyzer::reset()
+{
+    memset(ring, 0, sizeof(ring));
+    memset(re, 0, sizeof(re));
+    memset(im, 0, sizeof(im));
+    head = 0;
+    filled = 0;
+    sinceRecompute = 0;
+    bucketStart = 0;
+    bucketSum = 0;
+    bucketTime = 0;
+    havePrevious = false;
+    prevTime = 0;
+    prevAxis = 0;
+    direction = 0;
+    holdUntil = 0;
+    foundCount = 0;
+    rms = 0;
+}
+
+void SiTechTrackingAnalyzer::addSample(double time, double axisDegrees, double expectedRate)
+{
+    if (!havePrevious || time - prevTime > PE_MAX_GAP || time <= prevTime)
+    {
+        if (havePrevious && time - prevTime > PE_MAX_GAP) reset();
+        havePrevious = true;
+        prevTime = time;
+        prevAxis = axisDegrees;
+        bucketStart = time;
+        return;
+    }
+
+    // The interval spans a guide pulse or jog: step over it without a reset
+    if (time < holdUntil)
+    {
+        prevTime = time;
+        prevAxis = axisDegrees;
+        closeBucket(time);
+        return;
+    }
+
+    double dt = time - prevTime;
+    double move = axisDegrees - prevAxis;
+    if (move > 180) move -= 360;
+    if (move < -180) move += 360;
+    double observed = move * 3600.0 / dt;
+    prevTime = time;
+    prevAxis = axisDegrees;
+
+    // Which way the axis turns is a matter of mount and pier side; learn it
+    if (direction == 0)
+    {
+        if (fabs(observed) < expectedRate / 2) return;
+        direction = observed > 0 ? 1 : -1;
+    }
+
+    bucketSum += (direction * observed - expectedRate) * dt;
+    bucketTime += dt;
+    closeBucket(time);
+}
+
+void SiTechTrackingAnalyzer::holdFor(double time, double seconds)
+{
+    double until = time + seconds + PE_HOLD_MARGIN;
+    if (until > holdUntil) holdUntil = until;
+}
+
+void SiTechTrackingAnalyzer::closeBucket(double time)
+{
+    if (time - bucketStart < PE_SAMPLE_SECONDS) return;
+
+    // A bucket that was all move repeats the last one so the buckets stay evenly spaced
+    if (bucketTime > 0)
+        pushBucket(bucketSum / bucketTime);
+    else if (filled > 0)
+        pushBucket(ring[(head + PE_WINDOW - 1) % PE_WINDOW]);
+    bucketStart = time;
+    bucketSum = 0;
+    bucketTime = 0;
+}
+
+void SiTechTrackingAnalyzer::pushBucket(double value)
+{
+    double oldest = ring[head];
+    ring[head] = value;
+    head = (head + 1) % PE_WINDOW;
+    if (filled < PE_WINDOW) filled++;
+
+    // S_k <- (S_k + new - oldest) * e^(j 2 pi k / N)
+    double delta = value - oldest;
+    for (int k = 0; k < PE_BINS; k++)
+    {
+        double r = re[k] + delta;
+        double i = im[k];
+        re[k] = r * twCos[k] - i * twSin[k];
+        im[k] = r * twSin[k] + i * twCos[k];
+    }
+
+    // Rounding error accumulates in a sliding DFT; start clean once a window
+    if (++sinceRecompute >= PE_WINDOW)
+        recompute();
+
+    if (isReady()) analyse();
+}
+
+void SiTechTrackingAnalyzer::recompute()
+{
+    sinceRecompute = 0;
+
+    // Oldest first, so the plain DFT lines up with the sliding one
+    double x[PE_WINDOW];
+    for (int m = 0; m < PE_WINDOW; m++)
+        x[m] = ring[(head + m) % PE_WINDOW];
+
+    // e^(-j 2 pi k m / N) straight from the twiddle table, no trig per term
+    for (int k = 0; k < PE_BINS; k++)
+    {
+        double r = 0, i = 0;
+        int idx = 0;
+        for (int m = 0; m < PE_WINDOW; m++)
+        {
+            r += x[m] * twCos[idx];
+            i -= x[m] * twSin[idx];
+            idx += k;
+            if (idx >= PE_WINDOW) idx -= PE_WINDOW;
+        }
+        re[k] = r;
+        im[k] = i;
+    }
+}
+
+double SiTechTrackingAnalyzer::rateError() const
+{
+    if (filled == 0) return 0;
+    if (isReady()) return re[0] / PE_WINDOW;
+    double sum = 0;
+    for (int i = 0; i < filled; i++) sum += ring[i];
+    return sum / filled;
+}
+
+void SiTechTrackingAnalyzer::analyse()
+{
+    // Hann window applied in the frequency domain, then converted to position amplitude
+    double amp[PE_BINS];
+    double window = PE_WINDOW * PE_SAMPLE_SECONDS;
+    double sumSq = 0;
+    for (int k = 0; k < PE_BINS; k++)
+    {
+        amp[k] = 0;
+        if (k < PE_MIN_BIN || k >= PE_BINS - 1) continue;
+        double r = 0.5 * re[k] - 0.25 * (re[k - 1] + re[k + 1]);
+        double i = 0.5 * im[k] - 0.25 * (im[k - 1] + im[k + 1]);
+        // Hann halves the coherent gain, so 4/N instead of 2/N for a one-sided amplitude
+        double rateAmp = 4.0 * sqrt(r * r + i * i) / PE_WINDOW;
+        double period = window / k;
+        amp[k] = rateAmp * period / (2 * M_PI);
+        sumSq += amp[k] * amp[k] / 2;
+    }
+    // Hann spreads each line over three bins with gains 1, 1/2, 1/2
+    rms = sqrt(sumSq / 1.5);
+
+    foundCount = 0;
+    for (int k = PE_MIN_BIN + 1; k < PE_BINS - 2; k++)
+    {
+        if (amp[k] <= amp[k - 1] || amp[k] < amp[k + 1]) continue;
+
+        // Parabolic interpolation of the peak between bins
+        double a = amp[k - 1], b = amp[k], c = amp[k + 1];
+        double den = a - 2 * b + c;
+        double shift = (den != 0) ? 0.5 * (a - c) / den : 0;
+        SiTechPEPeak peak;
+        peak.period = window / (k + shift);
+        peak.amplitude = b - 0.25 * (a - c) * shift;
+
+        // Keep the PE_PEAKS largest, sorted
+        int pos = foundCount;
+        while (pos > 0 && found[pos - 1].amplitude < peak.amplitude) pos--;
+        if (pos >= PE_PEAKS) continue;
+        int last = (foundCount < PE_PEAKS) ? foundCount : PE_PEAKS - 1;
+        for (int j = last; j > pos; j--) found[j] = found[j - 1];
+        found[pos] = peak;
+        if (foundCount < PE_PEAKS) foundCount++;
+    }
+}
+
+int SiTechTrackingAnalyzer::peaks(SiTechPEPeak *out, int maxPeaks) const
+{
+    int n = (foundCount < maxPeaks) ? foundCount : maxPeaks;
+    for (int i = 0; i < n; i++) out[i] = found[i];
+    return n;
+}
@@ -0,0 +1,111 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Streaming tracking error / periodic error analysis.
+ *
+ * Fed with the tracking axis angle at every status poll and the rate the axis
+ * should be turning at.  The rate error (observed minus expected, arcsec/s) is
+ * averaged into PE_SAMPLE_SECONDS buckets and pushed through a sliding DFT over
+ * the last PE_WINDOW buckets, so each bucket costs PE_WINDOW/2 complex
+ * multiply-adds and no FFT is ever run from scratch.  The rate spectrum is
+ * turned back into position amplitude per period (A = rate amplitude * P / 2pi),
+ * which is the periodic error as a guider would see it.
+ *
+ * A constant rate error lands in the DC bin and is reported separately, so a
+ * slightly wrong track rate does not show up as periodic error.
+ */
+
+#ifndef SITECH_PEC_H
+#define SITECH_PEC_H
+
+#define PE_SAMPLE_SECONDS   2.0                 /* bucket length */
+#define PE_WINDOW           1024                /* buckets in the analysis window, 34 minutes */
+#define PE_PEAKS            3
+#define PE_MAX_GAP          5.0                 /* seconds without a sample before the analysis restarts */
+#define PE_HOLD_MARGIN      1.0                 /* seconds after a guide pulse or jog before samples count again */
+
+struct SiTechPEPeak
+{
+    double period;          /* seconds */
+    double amplitude;       /* arcsec, half peak-to-peak */
+};
+
+class SiTechTrackingAnalyzer
+{
+public:
+    SiTechTrackingAnalyzer();
+
+    /* Start over, e.g. after a slew or a track mode change. */
+    void reset();
+
+    /* One sample: host time (s), tracking axis angle (deg), expected axis rate (arcsec/s, unsigned). */
+    void addSample(double time, double axisDegrees, double expectedRate);
+
+    /* A guide pulse or jog moves the axis on purpose from time (s) for seconds;
+     * samples until it has settled are left out of the spectrum. */
+    void holdFor(double time, double seconds);
+
+    /* Window fill, 0..1.  The spectrum is only reported once the window is full. */
+    double fill() const { return (double) filled / PE_WINDOW; }
+    bool isReady() const { return filled == PE_WINDOW; }
+
+    /* Mean rate error over the window, arcsec/s. */
+    double rateError() const;
+
+    /* RMS position error in the periodic part of the spectrum, arcsec. */
+    double periodicRms() const { return rms; }
+
+    /* Strongest periods, largest first.  Returns the number found. */
+    int peaks(SiTechPEPeak *out, int maxPeaks) const;
+
+private:
+    void closeBucket(double time);
+    void pushBucket(double value);
+    void recompute();
+    void analyse();
+
+    // Ring of bucket values, oldest at head once full
+    double ring[PE_WINDOW];
+    int head;
+    int filled;
+    int sinceRecompute;
+
+    // Sliding DFT bins 0..PE_WINDOW/2 and twiddles e^(j 2 pi n / N) over a full period
+    double re[PE_WINDOW / 2 + 1];
+    double im[PE_WINDOW / 2 + 1];
+    double twCos[PE_WINDOW];
+    double twSin[PE_WINDOW];
+
+    // Current bucket
+    double bucketStart;
+    double bucketSum;
+    double bucketTime;
+
+    // Previous sample
+    bool havePrevious;
+    double prevTime;
+    double prevAxis;
+    double direction;       /* +1/-1, the way the axis turns while tracking */
+    double holdUntil;       /* samples before this are moves, not tracking */
+
+    SiTechPEPeak found[PE_PEAKS];
+    int foundCount;
+    double rms;
+};
+
+#endif // SITECH_PEC_H
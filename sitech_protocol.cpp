@@ -0,0 +1,124 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sitech_protocol.h"
+
+bool SiTechStatus::answers(const char *command) const
+{
+    return strstr(message, command) != NULL;
+}
+
+int SiTechParseFields(const char *reply, double *fields, int maxFields)
+{
+    int n = 0;
+    const char *p = reply;
+    while (p != NULL && *p != '\0' && *p != '_' && n < maxFields)
+    {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p) break;
+        fields[n++] = v;
+        p = strchr(end, ';');
+        if (p) p++;
+    }
+    return n;
+}
+
+bool SiTechParseStatus(const char *reply, SiTechStatus *status)
+{
+    memset(status, 0, sizeof(*status));
+    if (reply == NULL || strlen(reply) < 3) return false;
+
+    double f[SITECH_STATUS_FIELDS];
+    int n = SiTechParseFields(reply, f, SITECH_STATUS_FIELDS);
+    if (n < 1) return false;
+
+    status->fields = n;
+    status->bits = (int) f[0];
+    double *values[SITECH_STATUS_FIELDS - 1] =
+    {
+        &status->ra, &status->dec, &status->alt, &status->az, &status->axisSecondary, &status->axisPrimary,
+        &status->siderealTime, &status->julianDay, &status->scopeTime, &status->airmass
+    };
+    for (int i = 1; i < n; i++)
+        *values[i - 1] = f[i];
+
+    const char *msg = strchr(reply, '_');
+    if (msg != NULL)
+    {
+        strncpy(status->message, msg + 1, SITECH_MESSAGE_LEN - 1);
+        status->message[SITECH_MESSAGE_LEN - 1] = '\0';
+    }
+    return true;
+}
+
+bool SiTechParseSiteLocation(const char *reply, double *latitude, double *longitude, double *elevation)
+{
+    double f[3];
+    if (reply == NULL || strstr(reply, "SiteLocations") == NULL || SiTechParseFields(reply, f, 3) != 3)
+        return false;
+    *latitude = f[0];
+    *longitude = f[1];
+    *elevation = f[2];
+    return true;
+}
+
+int SiTechEncodeGoTo(char *buf, size_t len, double ra, double dec, bool j2000)
+{
+    return snprintf(buf, len, j2000 ? "GoTo %f %f J2K" : "GoTo %f %f", ra, dec);
+}
+
+int SiTechEncodeGoToAltAz(char *buf, size_t len, double az, double alt)
+{
+    return snprintf(buf, len, "GoToAltAz %f %f", az, alt);
+}
+
+int SiTechEncodeSync(char *buf, size_t len, double ra, double dec, int mode)
+{
+    return snprintf(buf, len, "Sync %f %f %d", ra, dec, mode);
+}
+
+int SiTechEncodePark(char *buf, size_t len, int mode)
+{
+    return snprintf(buf, len, "Park %d", mode);
+}
+
+int SiTechEncodeSetTrackMode(char *buf, size_t len, bool track, bool useRates, double raRate, double decRate)
+{
+    // Second parameter: 1 = track at the rates given, 0 = sidereal
+    return snprintf(buf, len, "SetTrackMode %d %d %f %f", track ? 1 : 0, (track && useRates) ? 1 : 0, raRate, decRate);
+}
+
+int SiTechEncodePulseGuide(char *buf, size_t len, SiTechGuideDirection direction, int milliseconds)
+{
+    return snprintf(buf, len, "PulseGuide %d %d", (int) direction, milliseconds);
+}
+
+int SiTechEncodeJog(char *buf, size_t len, char direction, double arcseconds)
+{
+    return snprintf(buf, len, "JogArcSeconds %c %.2f", direction, arcseconds);
+}
+
+int SiTechEncodeOffsetDestination(char *buf, size_t len, double raHours, double decDegrees)
+{
+    return snprintf(buf, len, "OffsetDestinationBy %.8f %.7f", raHours, decDegrees);
+}
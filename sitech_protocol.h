@@ -0,0 +1,117 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* SiTechExe ASCII protocol: status frames and command lines.
+ *
+ * Every command is one line and every reply one status frame,
+ *
+ *     bits;RA;Dec;Alt;Az;secondary;primary;LST;JD;scopeTime;airmass;_message
+ *
+ * RA and LST in hours, the rest in degrees, scope time in hours.  The message
+ * after the underscore names the command that was answered, or says why it
+ * was refused.  See SiTechTCPProtocol.txt.
+ */
+
+#ifndef SITECH_PROTOCOL_H
+#define SITECH_PROTOCOL_H
+
+#include <stddef.h>
+
+/* Status bits */
+#define SITECH_STT_INITIALIZED  0x0001
+#define SITECH_STT_TRACKING     0x0002
+#define SITECH_STT_SLEWING      0x0004          /* slewing or settling */
+#define SITECH_STT_PARKING      0x0008
+#define SITECH_STT_PARKED       0x0010
+#define SITECH_STT_LOOKING_EAST 0x0020
+#define SITECH_STT_BLINKY       0x0040          /* a servo is in manual mode */
+#define SITECH_STT_COMM_BAD     0x0080          /* SiTechExe cannot talk to the controller */
+#define SITECH_STT_LIMITS       0x0F00          /* any limit switch */
+#define SITECH_STT_HOME         0x3000          /* either home switch */
+
+#define SITECH_STATUS_FIELDS    11              /* numeric fields of a full frame, airmass included */
+#define SITECH_MESSAGE_LEN      256
+
+/* Commands without arguments */
+#define SITECH_CMD_STATUS       "ReadScopeStatus"
+#define SITECH_CMD_DESTINATION  "ReadScopeDestination"
+#define SITECH_CMD_SITE         "SiteLocations"
+#define SITECH_CMD_ABORT        "Abort"
+#define SITECH_CMD_UNPARK       "UnPark"
+#define SITECH_CMD_BLINKY       "MotorsToBlinky"
+#define SITECH_CMD_AUTO         "MotorsToAuto"
+
+/* PulseGuide directions */
+enum SiTechGuideDirection
+{
+    GUIDE_DIR_NORTH,
+    GUIDE_DIR_SOUTH,
+    GUIDE_DIR_EAST,
+    GUIDE_DIR_WEST
+};
+
+struct SiTechStatus
+{
+    int fields;             /* numeric fields found, SITECH_STATUS_FIELDS for a full frame */
+    int bits;
+    double ra;              /* hours */
+    double dec;
+    double alt;
+    double az;
+    double axisSecondary;   /* degrees; the frame carries the secondary axis first */
+    double axisPrimary;
+    double siderealTime;    /* hours */
+    double julianDay;
+    double scopeTime;       /* hours */
+    double airmass;
+    char message[SITECH_MESSAGE_LEN];   /* after the underscore, may be empty */
+
+    bool isComplete() const     { return fields >= 10; }
+    bool isInitialized() const  { return bits & SITECH_STT_INITIALIZED; }
+    bool isTracking() const     { return bits & SITECH_STT_TRACKING; }
+    bool isSlewing() const      { return bits & SITECH_STT_SLEWING; }
+    bool isParking() const      { return bits & SITECH_STT_PARKING; }
+    bool isParked() const       { return bits & SITECH_STT_PARKED; }
+    bool isLookingEast() const  { return bits & SITECH_STT_LOOKING_EAST; }
+    bool isInBlinky() const     { return bits & SITECH_STT_BLINKY; }
+    bool isCommunicating() const { return !(bits & SITECH_STT_COMM_BAD); }
+
+    /* True if the message names the command, i.e. SiTechExe accepted it. */
+    bool answers(const char *command) const;
+};
+
+/* Parse a status frame.  False if it does not even start with the status bits. */
+bool SiTechParseStatus(const char *reply, SiTechStatus *status);
+
+/* The leading ';' separated numeric fields of any reply.  Returns how many. */
+int SiTechParseFields(const char *reply, double *fields, int maxFields);
+
+/* SiteLocations reply, "latitude;longitude;elevation;_SiteLocations". */
+bool SiTechParseSiteLocation(const char *reply, double *latitude, double *longitude, double *elevation);
+
+/* Command lines, without line ending.  Return snprintf's result. */
+int SiTechEncodeGoTo(char *buf, size_t len, double ra, double dec, bool j2000 = false);
+int SiTechEncodeGoToAltAz(char *buf, size_t len, double az, double alt);
+int SiTechEncodeSync(char *buf, size_t len, double ra, double dec, int mode = 0);
+int SiTechEncodePark(char *buf, size_t len, int mode = 0);
+int SiTechEncodeSetTrackMode(char *buf, size_t len, bool track, bool useRates, double raRate, double decRate);
+int SiTechEncodePulseGuide(char *buf, size_t len, SiTechGuideDirection direction, int milliseconds);
+int SiTechEncodeJog(char *buf, size_t len, char direction, double arcseconds);
+int SiTechEncodeOffsetDestination(char *buf, size_t len, double raHours, double decDegrees);
+
+#endif // SITECH_PROTOCOL_H
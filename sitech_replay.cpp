@@ -0,0 +1,356 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* sitech_replay: serve a capture back to the driver as a fake SiTechExe.
+ *
+ *     sitech_replay [-s speed] [-v] capture port
+ *
+ * The capture (written by the driver's Capture property, see sitech_capture.h)
+ * is cut into exchanges: a command line and the reply line that answered it.
+ * Whoever connects to the port is then answered from them.
+ *
+ * With a speed (default 1) the session runs on a clock that starts at the
+ * first connection and goes speed times as fast as the captured one.  A
+ * command gets the reply to the same command line nearest ahead of that
+ * clock, or failing that to the same command ahead of it, then behind it, or
+ * the last reply given, and gets it after the captured round trip divided by
+ * the speed.  The replay
+ * ends when the clock passes the end of the capture.
+ *
+ * With -s 0 the clock is ignored: commands are answered strictly in capture
+ * order and at once, which replays the same replies whatever the driver's
+ * timing.  The replay ends when the capture is used up.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sitech_capture.h"
+#include "sitech_clock.h"
+
+#define REPLAY_LOOKAHEAD    32              /* exchanges searched ahead of the session clock */
+#define REPLAY_LOOKBACK     10000
+#define REPLAY_POLL_MS      100
+#define MIN_REPLY_LEN       3               /* as the transport: shorter lines are not replies */
+
+enum Match { MATCH_EXACT, MATCH_NAME, MATCH_EARLIER, MATCH_NONE };
+static const char *matchName[] = { "exact", "same command", "earlier", "substituted" };
+
+struct Exchange
+{
+    std::string command;
+    std::string reply;      /* with its line ending */
+    double sendTime;
+    double receiveTime;
+};
+
+static std::vector<Exchange> exchanges;
+static std::mutex replayLock;
+static size_t cursor = 0;
+static double speed = 1.0;
+static double sessionStart = 0;         /* host time of the first connection, 0 before */
+static std::string lastReply;
+static bool verbose = false;
+static std::atomic<bool> finished(false);
+
+static struct
+{
+    unsigned long commands;
+    unsigned long matched[MATCH_NONE + 1];      /* by Match, as the verbose lines label them */
+} counts;
+
+static void stop(int)
+{
+    finished = true;
+}
+
+/* Capture time the session clock has reached. */
+static double sessionTime(double hostTime)
+{
+    return exchanges[0].sendTime + (hostTime - sessionStart) * speed;
+}
+
+/* Pop complete lines off the front of buf; the line ending stays on raw. */
+static bool takeLine(std::string &buf, std::string &line, std::string &raw)
+{
+    size_t nl = buf.find('\n');
+    if (nl == std::string::npos) return false;
+    raw = buf.substr(0, nl + 1);
+    buf.erase(0, nl + 1);
+    size_t len = raw.size();
+    while (len > 0 && (raw[len - 1] == '\r' || raw[len - 1] == '\n')) len--;
+    line = raw.substr(0, len);
+    return true;
+}
+
+static std::string firstWord(const std::string &line)
+{
+    size_t sp = line.find(' ');
+    return sp == std::string::npos ? line : line.substr(0, sp);
+}
+
+static bool load(const char *path)
+{
+    char err[256];
+    SiTechCaptureReader reader;
+    if (!reader.open(path, err, sizeof(err)))
+    {
+        fprintf(stderr, "%s\n", err);
+        return false;
+    }
+
+    // Pair the replies on each connection with its commands, in order, as SiTechExe answers them
+    std::string out[2], in[2];
+    std::deque<std::pair<std::string, double> > waiting[2];
+    static char data[1 << 20];
+    SiTechCaptureRecord rec;
+    while (reader.next(&rec, data, sizeof(data)))
+    {
+        int link = rec.link ? 1 : 0;
+        std::string line, raw;
+        if (rec.direction == CAPTURE_SENT)
+        {
+            out[link].append(data, rec.length);
+            while (takeLine(out[link], line, raw))
+                if (!line.empty()) waiting[link].push_back(std::make_pair(line, rec.time));
+        }
+        else
+        {
+            in[link].append(data, rec.length);
+            while (takeLine(in[link], line, raw))
+            {
+                if (line.size() < MIN_REPLY_LEN || waiting[link].empty()) continue;
+                Exchange ex;
+                ex.command = waiting[link].front().first;
+                ex.sendTime = waiting[link].front().second;
+                ex.reply = raw;
+                ex.receiveTime = rec.time;
+                waiting[link].pop_front();
+                exchanges.push_back(ex);
+            }
+        }
+    }
+
+    std::stable_sort(exchanges.begin(), exchanges.end(),
+                     [](const Exchange &a, const Exchange &b) { return a.sendTime < b.sendTime; });
+    if (exchanges.empty())
+    {
+        fprintf(stderr, "%s: no complete exchanges\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* Pick the reply to a command.  Returns the host time to send it at. */
+static double answer(const std::string &command, double arrival, std::string &reply)
+{
+    std::lock_guard<std::mutex> guard(replayLock);
+    counts.commands++;
+
+    size_t n = exchanges.size();
+    if (speed > 0)
+    {
+        double now = sessionTime(arrival);
+        while (cursor + 1 < n && exchanges[cursor + 1].sendTime <= now) cursor++;
+        if (now > exchanges[n - 1].receiveTime) finished = true;
+    }
+
+    std::string name = firstWord(command);
+    size_t found = n;
+    Match how = MATCH_NONE;
+    for (size_t i = cursor; i < n && i < cursor + REPLAY_LOOKAHEAD; i++)
+        if (exchanges[i].command == command) { found = i; how = MATCH_EXACT; break; }
+    if (found == n)
+        for (size_t i = cursor; i < n && i < cursor + REPLAY_LOOKAHEAD; i++)
+            if (firstWord(exchanges[i].command) == name) { found = i; how = MATCH_NAME; break; }
+    if (found == n)
+        for (size_t i = cursor; i > 0 && cursor - i < REPLAY_LOOKBACK; i--)
+            if (firstWord(exchanges[i - 1].command) == name) { found = i - 1; how = MATCH_EARLIER; break; }
+
+    double delay = 0;
+    if (found < n)
+    {
+        const Exchange &ex = exchanges[found];
+        reply = ex.reply;
+        if (speed > 0) delay = (ex.receiveTime - ex.sendTime) / speed;
+        if (found >= cursor)
+        {
+            cursor = found + 1;
+            if (speed <= 0 && cursor >= n) finished = true;
+        }
+    }
+    else
+        reply = lastReply.empty() ? exchanges[0].reply : lastReply;
+    counts.matched[how]++;
+    lastReply = reply;
+
+    if (verbose)
+        printf("%10.3f %-40s %s\n", arrival - sessionStart, command.c_str(), matchName[how]);
+    return arrival + delay;
+}
+
+static void sleepUntil(double when)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) when;
+    ts.tv_nsec = (long) ((when - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR && !finished)
+        ;
+}
+
+static void serve(int fd)
+{
+    std::string buf, line, raw, reply;
+    char data[4096];
+    while (!finished)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int rc = poll(&pfd, 1, REPLAY_POLL_MS);
+        if (rc < 0 && errno != EINTR) break;
+        if (rc <= 0) continue;
+
+        ssize_t n = read(fd, data, sizeof(data));
+        if (n <= 0) break;
+        double arrival = SiTechHostTime();
+        buf.append(data, n);
+
+        // Pipelined commands are answered in order, each after its own round trip
+        while (takeLine(buf, line, raw))
+        {
+            if (line.empty()) continue;
+            sleepUntil(answer(line, arrival, reply));
+            if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) break;
+        }
+    }
+    close(fd);
+}
+
+static int listenOn(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: sitech_replay [-s speed] [-v] capture port\n"
+                    "  -s speed  session clock rate, 1 = real time (default), 0 = capture order, no waits\n"
+                    "  -v        print every command and how it was answered\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': speed = atof(optarg); break;
+            case 'v': verbose = true; break;
+            default: usage(); return 2;
+        }
+    }
+    if (argc - optind != 2 || speed < 0)
+    {
+        usage();
+        return 2;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (!load(argv[optind])) return 1;
+    const Exchange &first = exchanges.front(), &last = exchanges.back();
+    printf("%zu exchanges over %.1f s\n", exchanges.size(), last.receiveTime - first.sendTime);
+
+    int port = atoi(argv[optind + 1]);
+    int server = listenOn(port);
+    if (server < 0)
+    {
+        fprintf(stderr, "port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    printf("listening on port %d at %gx\n", port, speed);
+
+    std::vector<std::thread> clients;
+    while (!finished)
+    {
+        if (speed > 0)
+        {
+            std::lock_guard<std::mutex> guard(replayLock);
+            if (sessionStart > 0 && sessionTime(SiTechHostTime()) > last.receiveTime) finished = true;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = server;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, REPLAY_POLL_MS) <= 0) continue;
+
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0) continue;
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        {
+            std::lock_guard<std::mutex> guard(replayLock);
+            if (sessionStart == 0) sessionStart = SiTechHostTime();
+        }
+        clients.push_back(std::thread(serve, fd));
+    }
+    for (size_t i = 0; i < clients.size(); i++) clients[i].join();
+    close(server);
+
+    double took = sessionStart > 0 ? SiTechHostTime() - sessionStart : 0;
+    printf("%lu commands in %.1f s: %lu %s, %lu %s, %lu %s, %lu %s\n", counts.commands, took,
+           counts.matched[MATCH_EXACT], matchName[MATCH_EXACT], counts.matched[MATCH_NAME], matchName[MATCH_NAME],
+           counts.matched[MATCH_EARLIER], matchName[MATCH_EARLIER], counts.matched[MATCH_NONE], matchName[MATCH_NONE]);
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "sitech_schedule.h"
+
+SiTechScheduler::SiTechScheduler(SiTechTransport &link) : transport(link)
+{
+    running = false;
+    hold = false;
+    pipeFd[0] = pipeFd[1] = -1;
+    nextId = 1;
+}
+
+SiTechScheduler::~SiTechScheduler()
+{
+    stop();
+}
+
+bool SiTechScheduler::start(char *err, size_t errLen)
+{
+    if (running) return true;
+
+    if (pipe(pipeFd) != 0)
+    {
+        snprintf(err, errLen, "pipe: %s", strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+        fcntl(pipeFd[i], F_SETFL, fcntl(pipeFd[i], F_GETFL) | O_NONBLOCK);
+
+    running = true;
+    worker = std::thread(&SiTechScheduler::run, this);
+    return true;
+}
+
+void SiTechScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running) return;
+        running = false;
+        queue.clear();
+    }
+    cv.notify_all();
+    if (worker.joinable()) worker.join();
+
+    close(pipeFd[0]);
+    close(pipeFd[1]);
+    pipeFd[0] = pipeFd[1] = -1;
+    results.clear();
+}
+
+int SiTechScheduler::add(const char *command, double mountTime)
+{
+    Entry e;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running || queue.size() >= SCHEDULE_MAX) return -1;
+
+        e.id = nextId++;
+        e.mountTime = mountTime;
+        strncpy(e.command, command, SCHEDULE_CMD_LEN - 1);
+        e.command[SCHEDULE_CMD_LEN - 1] = '\0';
+
+        std::vector<Entry>::iterator it = queue.begin();
+        while (it != queue.end() && it->mountTime <= mountTime) ++it;
+        queue.insert(it, e);
+    }
+    cv.notify_all();
+    return e.id;
+}
+
+int SiTechScheduler::cancelAll()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int n = queue.size();
+    queue.clear();
+    cv.notify_all();
+    return n;
+}
+
+int SiTechScheduler::pending()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return queue.size();
+}
+
+bool SiTechScheduler::next(double *mountTime, char *command, size_t len)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (queue.empty()) return false;
+    *mountTime = queue.front().mountTime;
+    snprintf(command, len, "%s", queue.front().command);
+    return true;
+}
+
+void SiTechScheduler::setClock(const SiTechClockEstimator &estimate)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        clock = estimate;
+    }
+    // The send time of the next entry may have moved
+    cv.notify_all();
+}
+
+int SiTechScheduler::takeResults(SiTechScheduledResult *out, int maxResults)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int n = 0;
+    while (n < maxResults && !results.empty())
+    {
+        out[n++] = results.front();
+        results.pop_front();
+    }
+    return n;
+}
+
+/* Host time to write a command so it reaches the mount at mountTime.  Called with the lock held. */
+double SiTechScheduler::sendTimeFor(double mountTime) const
+{
+    if (!clock.isValid()) return mountTime;
+    return clock.mountToHost(mountTime) - clock.minRoundTrip() / 2;
+}
+
+void SiTechScheduler::post(const SiTechScheduledResult &result)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        results.push_back(result);
+    }
+    char c = 1;
+    if (write(pipeFd[1], &c, 1) < 0 && errno != EAGAIN)
+        perror("SiTechScheduler notify");
+}
+
+void SiTechScheduler::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (running)
+    {
+        if (queue.empty())
+        {
+            cv.wait(guard);
+            continue;
+        }
+
+        // Wait coarsely until just before the send time, then let the transport wait the rest exactly
+        double sendAt = sendTimeFor(queue.front().mountTime);
+        double now = SiTechHostTime();
+        if (now < sendAt - SCHEDULE_LEAD)
+        {
+            cv.wait_for(guard, std::chrono::microseconds((long long) ((sendAt - SCHEDULE_LEAD - now) * 1e6)));
+            continue;
+        }
+
+        Entry e = queue.front();
+        queue.erase(queue.begin());
+        SiTechClockEstimator estimate = clock;
+        guard.unlock();
+
+        SiTechScheduledResult result;
+        memset(&result, 0, sizeof(result));
+        result.id = e.id;
+        memcpy(result.command, e.command, SCHEDULE_CMD_LEN);
+        result.requested = e.mountTime;
+
+        if (hold)
+        {
+            result.held = true;
+            result.status = SITECH_OK;
+        }
+        else if (now > sendAt + SCHEDULE_MAX_LATE)
+        {
+            result.missed = true;
+            result.status = SITECH_OK;
+        }
+        else
+        {
+            // Lateness is checked again once the connection is ours, it may have been busy
+            const char *cmd = e.command;
+            char *reply = result.reply;
+            result.status = transport.transactAt(LANE_CONTROL, &cmd, 1, &reply, SCHEDULE_REPLY_LEN,
+                                                 sendAt, SCHEDULE_MAX_LATE, &result.sendTime, &result.receiveTime);
+            if (result.status == SITECH_TOO_LATE)
+            {
+                result.missed = true;
+                result.status = SITECH_OK;
+            }
+            double mid = result.sendTime + (result.receiveTime - result.sendTime) / 2;
+            result.fired = estimate.isValid() ? estimate.hostToMount(mid) : mid;
+        }
+        post(result);
+
+        guard.lock();
+    }
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Commands fired at a given instant on the mount clock.
+ *
+ * Entries carry a mount time (unix seconds on SiTechExe's clock, see
+ * sitech_clock.h).  A dispatch thread converts it to host time with the latest
+ * clock estimate, takes the connection SCHEDULE_LEAD before, and writes the
+ * command half a minimum round trip early so it arrives on time.  The exact
+ * wait is a clock_nanosleep to an absolute CLOCK_REALTIME deadline.
+ *
+ * Every fired command gives a result: when it was sent and, from the
+ * midpoint of its exchange, when the mount got it on its own clock.  Results
+ * are queued and a byte is written to notifyFd() so a single-threaded event
+ * loop can pick them up.
+ */
+
+#ifndef SITECH_SCHEDULE_H
+#define SITECH_SCHEDULE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sitech_clock.h"
+#include "sitech_transport.h"
+
+#define SCHEDULE_MAX            64
+#define SCHEDULE_CMD_LEN        128
+#define SCHEDULE_REPLY_LEN      512
+#define SCHEDULE_LEAD           0.05        /* seconds the connection is held before the send time */
+#define SCHEDULE_MAX_LATE       1.0         /* seconds past its time a command is dropped instead of sent */
+
+struct SiTechScheduledResult
+{
+    int id;
+    char command[SCHEDULE_CMD_LEN];
+    double requested;       /* mount time asked for */
+    double fired;           /* mount time it reached the mount, estimated */
+    double sendTime;        /* host */
+    double receiveTime;
+    int status;             /* SiTechLinkError */
+    bool missed;            /* too late, not sent */
+    bool held;              /* the mount was parked, not sent */
+    char reply[SCHEDULE_REPLY_LEN];
+};
+
+class SiTechScheduler
+{
+public:
+    explicit SiTechScheduler(SiTechTransport &transport);
+    ~SiTechScheduler();
+
+    bool start(char *err, size_t errLen);
+    void stop();
+    bool isRunning() const { return running; }
+
+    /* Readable when results are waiting; drain it and call takeResults(). */
+    int notifyFd() const { return pipeFd[0]; }
+
+    /* Queue a command for a mount time.  Returns its id, or -1 when full. */
+    int add(const char *command, double mountTime);
+    int cancelAll();
+    int pending();
+
+    /* Earliest entry still queued. */
+    bool next(double *mountTime, char *command, size_t len);
+
+    /* While held, commands that come due are dropped instead of sent, e.g.
+     * while the mount is parked.  Refresh from every status. */
+    void setHold(bool on) { hold = on; }
+
+    /* Copy of the clock estimate used to place commands, refresh after every sample. */
+    void setClock(const SiTechClockEstimator &estimate);
+
+    int takeResults(SiTechScheduledResult *out, int maxResults);
+
+private:
+    struct Entry
+    {
+        int id;
+        double mountTime;
+        char command[SCHEDULE_CMD_LEN];
+    };
+
+    void run();
+    double sendTimeFor(double mountTime) const;
+    void post(const SiTechScheduledResult &result);
+
+    SiTechTransport &transport;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool running;
+    std::atomic<bool> hold;
+    int pipeFd[2];
+    int nextId;
+
+    std::vector<Entry> queue;                   /* sorted by mount time */
+    std::deque<SiTechScheduledResult> results;
+    SiTechClockEstimator clock;
+};
+
+#endif // SITECH_SCHEDULE_H
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Last-writer-wins queue of pending settings.
+ *
+ * A client dragging a slider sends a new value for every step.  Each setting
+ * has one slot: posting a value replaces whatever is still pending there and
+ * counts the old one as superseded, and whoever sends settings to the mount
+ * takes only the latest value of each slot once the link is free.  However
+ * fast the values come, a slot costs at most one command per flush.
+ */
+
+#ifndef SITECH_SETTINGS_H
+#define SITECH_SETTINGS_H
+
+#include <mutex>
+
+#define SETTING_MAX_VALUES  4
+
+enum SiTechSetting
+{
+    SETTING_TRACK,          /* track mode, RA rate, Dec rate */
+    SETTING_GUIDE_RATE,     /* W/E, N/S */
+    SETTING_SLEW_RATE,      /* slew rate index */
+    SETTING_COUNT
+};
+
+class SiTechSettingQueue
+{
+public:
+    SiTechSettingQueue() { clear(); }
+
+    /* Returns true when a pending value was superseded; it is copied to
+     * previous (SETTING_MAX_VALUES) if given. */
+    bool post(SiTechSetting slot, const double *values, int count, double *previous = 0)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Slot &s = slots[slot];
+        bool replaced = s.pending;
+        if (replaced)
+        {
+            s.superseded++;
+            if (previous != 0)
+                for (int i = 0; i < SETTING_MAX_VALUES; i++) previous[i] = s.values[i];
+        }
+        for (int i = 0; i < SETTING_MAX_VALUES; i++)
+            s.values[i] = (i < count) ? values[i] : 0;
+        s.pending = true;
+        return replaced;
+    }
+
+    /* Latest value of a slot and how many values it replaced since the last
+     * take.  False if nothing is pending. */
+    bool take(SiTechSetting slot, double *values, unsigned *superseded = 0)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Slot &s = slots[slot];
+        if (!s.pending) return false;
+        for (int i = 0; i < SETTING_MAX_VALUES; i++) values[i] = s.values[i];
+        if (superseded != 0) *superseded = s.superseded;
+        s.pending = false;
+        s.superseded = 0;
+        return true;
+    }
+
+    bool isPending(SiTechSetting slot)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return slots[slot].pending;
+    }
+
+    bool hasPending()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < SETTING_COUNT; i++)
+            if (slots[i].pending) return true;
+        return false;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < SETTING_COUNT; i++)
+        {
+            slots[i].pending = false;
+            slots[i].superseded = 0;
+            for (int j = 0; j < SETTING_MAX_VALUES; j++) slots[i].values[j] = 0;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        bool pending;
+        unsigned superseded;
+        double values[SETTING_MAX_VALUES];
+    };
+
+    std::mutex lock;
+    Slot slots[SETTING_COUNT];
+};
+
+#endif // SITECH_SETTINGS_H
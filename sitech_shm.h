@@ -0,0 +1,250 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Shared-memory mount status.
+ *
+ * The driver publishes the last decoded SiTechExe status frame to a POSIX
+ * shared-memory segment named "/indi_<device name>" (see SiTechShmName).
+ * Writers and readers synchronise with a seqlock: the writer makes the
+ * sequence odd, copies the frame, then makes it even again.  A reader copies
+ * the frame and retries if the sequence was odd or changed under it, so it
+ * never blocks the driver and never sees a torn frame.
+ *
+ * This header has no INDI dependency.  A local consumer only needs:
+ *
+ *     SiTechShmReader reader;
+ *     SiTechShmFrame frame;
+ *     if (reader.open("/indi_SiTechScopeA") && reader.read(frame))
+ *         printf("RA=%f DEC=%f\n", frame.ra, frame.dec);
+ *
+ * When the driver disconnects it clears the magic and removes the segment;
+ * read() then fails and a reader has to open the new segment after the
+ * driver reconnects.
+ *
+ * Link with -lrt on older glibc.
+ */
+
+#ifndef SITECH_SHM_H
+#define SITECH_SHM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+
+#define SITECH_SHM_MAGIC   0x53695465   /* "SiTe" */
+#define SITECH_SHM_VERSION 1
+
+/* One decoded status frame.  Plain data only, so it can be memcpy'd. */
+struct SiTechShmFrame
+{
+    uint64_t sampleTimeNs;      /* CLOCK_REALTIME at the midpoint of the exchange, ns since epoch */
+    uint64_t frameCount;        /* frames published since the segment was created */
+    uint32_t statusBits;        /* boolParms from the SiTechExe reply */
+    uint32_t roundTripUs;       /* round trip of the exchange that produced the frame */
+    double ra;                  /* hours, JNow */
+    double dec;                 /* degrees, JNow */
+    double alt;                 /* degrees */
+    double az;                  /* degrees */
+    double axisPrimary;         /* degrees */
+    double axisSecondary;       /* degrees */
+    double siderealTime;        /* hours */
+    double julianDay;
+    double scopeTime;           /* hours */
+};
+
+struct SiTechShmSegment
+{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t frameSize;
+    SiTechShmFrame frame;
+};
+
+/* Segment name for a device, e.g. "/indi_SiTechScopeA".  Characters that are
+ * not allowed in a shm name are replaced with '_'. */
+inline void SiTechShmName(const char *deviceName, char *out, size_t outLen)
+{
+    if (outLen == 0) return;
+    snprintf(out, outLen, "/indi_%s", deviceName);
+    for (char *p = out + 1; *p; p++)
+        if (*p == '/' || *p == ' ') *p = '_';
+}
+
+inline uint64_t SiTechShmNowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Driver side.  Only one writer per segment. */
+class SiTechShmWriter
+{
+public:
+    SiTechShmWriter() : fd(-1), seg(NULL) { name[0] = '\0'; }
+    ~SiTechShmWriter() { close(); }
+
+    bool open(const char *shmName)
+    {
+        close();
+        strncpy(name, shmName, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, sizeof(SiTechShmSegment)) != 0)
+        {
+            close();
+            return false;
+        }
+        void *p = mmap(NULL, sizeof(SiTechShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        seg = (SiTechShmSegment *) p;
+        seg->sequence.store(0, std::memory_order_relaxed);
+        memset(&seg->frame, 0, sizeof(seg->frame));
+        seg->frameSize = sizeof(SiTechShmFrame);
+        seg->version = SITECH_SHM_VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        seg->magic = SITECH_SHM_MAGIC;
+        return true;
+    }
+
+    void close()
+    {
+        if (seg != NULL)
+        {
+            // Readers that still have it mapped see it go stale
+            seg->magic = 0;
+            std::atomic_thread_fence(std::memory_order_release);
+            munmap(seg, sizeof(SiTechShmSegment));
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+            shm_unlink(name);
+        }
+        seg = NULL;
+        fd = -1;
+    }
+
+    bool isOpen() const { return seg != NULL; }
+
+    void publish(const SiTechShmFrame &frame)
+    {
+        if (seg == NULL) return;
+        uint32_t seq = seg->sequence.load(std::memory_order_relaxed);
+        seg->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        uint64_t count = seg->frame.frameCount + 1;
+        memcpy(&seg->frame, &frame, sizeof(frame));
+        seg->frame.frameCount = count;
+        seg->sequence.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    int fd;
+    SiTechShmSegment *seg;
+    char name[128];
+};
+
+/* Consumer side.  Read-only mapping; any number of readers. */
+class SiTechShmReader
+{
+public:
+    SiTechShmReader() : fd(-1), seg(NULL) {}
+    ~SiTechShmReader() { close(); }
+
+    bool open(const char *shmName)
+    {
+        close();
+        fd = shm_open(shmName, O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SiTechShmSegment))
+        {
+            close();
+            return false;
+        }
+        void *p = mmap(NULL, sizeof(SiTechShmSegment), PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        seg = (const SiTechShmSegment *) p;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seg->magic != SITECH_SHM_MAGIC || seg->version != SITECH_SHM_VERSION || seg->frameSize != sizeof(SiTechShmFrame))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (seg != NULL) munmap((void *) seg, sizeof(SiTechShmSegment));
+        if (fd >= 0) ::close(fd);
+        seg = NULL;
+        fd = -1;
+    }
+
+    bool isOpen() const { return seg != NULL; }
+
+    /* Copy the latest frame.  Returns false if nothing has been published yet,
+     * the writer has closed the segment, or the writer kept the frame busy for
+     * maxRetries attempts. */
+    bool read(SiTechShmFrame &out, int maxRetries = 1000) const
+    {
+        if (seg == NULL) return false;
+        for (int i = 0; i < maxRetries; i++)
+        {
+            uint32_t s1 = seg->sequence.load(std::memory_order_acquire);
+            if (s1 & 1) continue;
+            memcpy(&out, (const void *) &seg->frame, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t s2 = seg->sequence.load(std::memory_order_relaxed);
+            if (s1 != s2) continue;
+            return s1 != 0 && seg->magic == SITECH_SHM_MAGIC;
+        }
+        return false;
+    }
+
+    /* Sequence number of the last complete frame; cheap change detection. */
+    uint32_t sequence() const
+    {
+        return seg == NULL ? 0 : seg->sequence.load(std::memory_order_acquire) & ~1U;
+    }
+
+private:
+    int fd;
+    const SiTechShmSegment *seg;
+};
+
+#endif // SITECH_SHM_H
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "sitech_slew.h"
+
+#define MIN_FIT_SLEWS   4
+
+SiTechSlewHistory::SiTechSlewHistory(double defaultSettleSeconds, double defaultDegreesPerSecond)
+{
+    used = 0;
+    next = 0;
+    settle = defaultSettleSeconds;
+    secondsPerDegree = 1.0 / defaultDegreesPerSecond;
+}
+
+double SiTechSlewHistory::distance(double ra1, double dec1, double ra2, double dec2)
+{
+    double dra = fmod(fabs(ra1 - ra2), 24.0);
+    if (dra > 12) dra = 24 - dra;
+    double ddec = fabs(dec1 - dec2);
+    dra *= 15.0;
+    return dra > ddec ? dra : ddec;
+}
+
+void SiTechSlewHistory::record(double distanceDegrees, double seconds)
+{
+    if (distanceDegrees < 0 || seconds <= 0) return;
+
+    distances[next] = distanceDegrees;
+    durations[next] = seconds;
+    next = (next + 1) % SLEW_HISTORY_SIZE;
+    if (used < SLEW_HISTORY_SIZE) used++;
+
+    if (used >= MIN_FIT_SLEWS) fit();
+}
+
+void SiTechSlewHistory::fit()
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < used; i++)
+    {
+        sx += distances[i];
+        sy += durations[i];
+        sxx += distances[i] * distances[i];
+        sxy += distances[i] * durations[i];
+    }
+    double n = used;
+    double den = n * sxx - sx * sx;
+
+    // All slews the same length: keep the rate, move the settle time
+    if (den <= 1e-9)
+    {
+        settle = sy / n - secondsPerDegree * sx / n;
+        if (settle < 0) settle = 0;
+        return;
+    }
+
+    double b = (n * sxy - sx * sy) / den;
+    double a = (sy - b * sx) / n;
+    if (b <= 0) return;     // noise, keep the previous model
+    secondsPerDegree = b;
+    settle = a > 0 ? a : 0;
+}
+
+double SiTechSlewHistory::estimate(double distanceDegrees) const
+{
+    return settle + distanceDegrees * secondsPerDegree;
+}
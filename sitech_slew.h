@@ -0,0 +1,57 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Slew duration model.
+ *
+ * Both axes slew at once, so a GoTo takes about as long as its larger axis
+ * move.  Completed slews are recorded as (distance, seconds) and the model
+ * duration = settle + distance * secondsPerDegree is fitted over the last
+ * SLEW_HISTORY_SIZE of them.  Until there are enough slews the defaults given
+ * to the constructor are used.
+ */
+
+#ifndef SITECH_SLEW_H
+#define SITECH_SLEW_H
+
+#define SLEW_HISTORY_SIZE   32
+
+class SiTechSlewHistory
+{
+public:
+    SiTechSlewHistory(double defaultSettleSeconds, double defaultDegreesPerSecond);
+
+    /* Larger axis move in degrees between two RA (hours) / Dec (degrees) positions. */
+    static double distance(double ra1, double dec1, double ra2, double dec2);
+
+    void record(double distanceDegrees, double seconds);
+    double estimate(double distanceDegrees) const;
+    int count() const { return used; }
+
+private:
+    void fit();
+
+    double distances[SLEW_HISTORY_SIZE];
+    double durations[SLEW_HISTORY_SIZE];
+    int used;
+    int next;
+
+    double settle;
+    double secondsPerDegree;
+};
+
+#endif // SITECH_SLEW_H
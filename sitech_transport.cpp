@@ -0,0 +1,463 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sitech_transport.h"
+#include "sitech_clock.h"
+
+#define DEFAULT_TIMEOUT     3.0             /* seconds, same as the INDI driver always used */
+#define MIN_REPLY_LEN       3               /* shorter lines are stray line endings, not replies */
+#define MAX_OWED            16              /* late replies remembered; past that SiTechExe is not answering anyway */
+
+SiTechLane SiTechLaneFor(const char *command)
+{
+    static const struct { const char *name; SiTechLane lane; } table[] =
+    {
+        { "Abort",                  LANE_SAFETY },
+        { "MotorsToBlinky",         LANE_SAFETY },
+        { "PulseGuide",             LANE_GUIDING },
+        { "JogArcSeconds",          LANE_GUIDING },
+        { "ReadScopeStatus",        LANE_TELEMETRY },
+        { "ReadScopeDestination",   LANE_TELEMETRY },
+        { "SiteLocations",          LANE_TELEMETRY },
+    };
+
+    size_t len = strcspn(command, " \r\n");
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+        if (strlen(table[i].name) == len && strncmp(command, table[i].name, len) == 0)
+            return table[i].lane;
+    return LANE_CONTROL;
+}
+
+SiTechLane SiTechLaneFor(const char *const *commands, int count)
+{
+    SiTechLane lane = LANE_TELEMETRY;
+    for (int i = 0; i < count; i++)
+    {
+        SiTechLane l = SiTechLaneFor(commands[i]);
+        if (l < lane) lane = l;
+    }
+    return lane;
+}
+
+const char *SiTechLaneName(SiTechLane lane)
+{
+    switch (lane)
+    {
+        case LANE_SAFETY:    return "safety";
+        case LANE_GUIDING:   return "guiding";
+        case LANE_CONTROL:   return "control";
+        case LANE_TELEMETRY: return "telemetry";
+        default:             return "?";
+    }
+}
+
+const char *SiTechLinkErrorString(int err)
+{
+    switch (err)
+    {
+        case SITECH_OK:             return "ok";
+        case SITECH_READ_ERROR:     return "read error";
+        case SITECH_WRITE_ERROR:    return "write error";
+        case SITECH_TIMEOUT:        return "timeout";
+        case SITECH_NOT_CONNECTED:  return "not connected";
+        case SITECH_OVERFLOW:       return "reply too long";
+        case SITECH_TOO_LATE:       return "too late";
+        default:                    return "unknown error";
+    }
+}
+
+SiTechTransport::SiTechTransport()
+{
+    timeout = DEFAULT_TIMEOUT;
+    resetStats();
+}
+
+SiTechTransport::~SiTechTransport()
+{
+    closePriorityLink();
+    closeMainLink();
+}
+
+void SiTechTransport::attach(int fd)
+{
+    std::lock_guard<std::mutex> guard(mainLink.lock);
+    mainLink.fd = fd;
+    mainLink.owned = false;
+    mainLink.owed = 0;
+    mainLink.len = 0;
+}
+
+void SiTechTransport::detach()
+{
+    std::lock_guard<std::mutex> guard(mainLink.lock);
+    mainLink.fd = -1;
+    mainLink.len = 0;
+}
+
+static int connectTo(const char *host, int port, char *err, size_t errLen)
+{
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, service, &hints, &res);
+    if (rc != 0)
+    {
+        snprintf(err, errLen, "%s: %s", host, gai_strerror(rc));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+    {
+        snprintf(err, errLen, "Cannot connect to %s:%d: %s", host, port, strerror(errno));
+        return -1;
+    }
+
+    // Short command lines must not wait for Nagle
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+bool SiTechTransport::openMainLink(const char *host, int port, char *err, size_t errLen)
+{
+    closeMainLink();
+
+    int fd = connectTo(host, port, err, errLen);
+    if (fd < 0) return false;
+
+    std::lock_guard<std::mutex> guard(mainLink.lock);
+    mainLink.fd = fd;
+    mainLink.owned = true;
+    mainLink.owed = 0;
+    mainLink.len = 0;
+    return true;
+}
+
+void SiTechTransport::closeMainLink()
+{
+    std::unique_lock<std::mutex> guard(mainLink.lock);
+    mainLink.cv.wait(guard, [this] { return !mainLink.busy; });
+    closeLink(mainLink);
+}
+
+bool SiTechTransport::openPriorityLink(const char *host, int port, char *err, size_t errLen)
+{
+    closePriorityLink();
+
+    int fd = connectTo(host, port, err, errLen);
+    if (fd < 0) return false;
+
+    std::lock_guard<std::mutex> guard(priorityLink.lock);
+    priorityLink.fd = fd;
+    priorityLink.owned = true;
+    priorityLink.owed = 0;
+    priorityLink.len = 0;
+    return true;
+}
+
+void SiTechTransport::closePriorityLink()
+{
+    std::unique_lock<std::mutex> guard(priorityLink.lock);
+    priorityLink.cv.wait(guard, [this] { return !priorityLink.busy; });
+    closeLink(priorityLink);
+}
+
+void SiTechTransport::closeLink(Link &link)
+{
+    if (link.fd >= 0 && link.owned) close(link.fd);
+    link.fd = -1;
+    link.owned = false;
+    link.len = 0;
+    link.owed = 0;
+}
+
+SiTechTransport::Link &SiTechTransport::linkFor(SiTechLane lane)
+{
+    if (lane == LANE_SAFETY || lane == LANE_GUIDING)
+    {
+        // closePriorityLink() may be clearing fd right now
+        std::lock_guard<std::mutex> guard(priorityLink.lock);
+        if (priorityLink.fd >= 0) return priorityLink;
+    }
+    return mainLink;
+}
+
+void SiTechTransport::acquire(Link &link, SiTechLane lane)
+{
+    std::unique_lock<std::mutex> guard(link.lock);
+    link.waiting[lane]++;
+    link.cv.wait(guard, [&link, lane]
+    {
+        if (link.busy) return false;
+        for (int i = 0; i < lane; i++)
+            if (link.waiting[i] > 0) return false;
+        return true;
+    });
+    link.waiting[lane]--;
+    link.busy = true;
+}
+
+void SiTechTransport::release(Link &link)
+{
+    {
+        std::lock_guard<std::mutex> guard(link.lock);
+        link.busy = false;
+    }
+    link.cv.notify_all();
+}
+
+int SiTechTransport::transact(SiTechLane lane, const char *command, char *reply, size_t replyLen,
+                              double *sendTime, double *receiveTime)
+{
+    return transactBatch(lane, &command, 1, &reply, replyLen, sendTime, receiveTime);
+}
+
+int SiTechTransport::transactBatch(const char *const *commands, int count, char **replies, size_t replyLen,
+                                   double *sendTime, double *receiveTime, int *results)
+{
+    return transactBatch(SiTechLaneFor(commands, count), commands, count, replies, replyLen, sendTime, receiveTime, results);
+}
+
+int SiTechTransport::transactBatch(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                                   double *sendTime, double *receiveTime, int *results)
+{
+    return exchange(lane, commands, count, replies, replyLen, 0, 0, sendTime, receiveTime, results);
+}
+
+int SiTechTransport::transactAt(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                                double sendAt, double maxLate, double *sendTime, double *receiveTime, int *results)
+{
+    return exchange(lane, commands, count, replies, replyLen, sendAt, maxLate, sendTime, receiveTime, results);
+}
+
+static void sleepUntil(double hostTime)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) hostTime;
+    ts.tv_nsec = (long) ((hostTime - ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+int SiTechTransport::exchange(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                              double sendAt, double maxLate, double *sendTime, double *receiveTime, int *results)
+{
+    double start = SiTechHostTime();
+    double sent = start, received = start;
+
+    for (int i = 0; i < count; i++)
+        if (replyLen > 0) replies[i][0] = '\0';
+
+    Link &link = linkFor(lane);
+    acquire(link, lane);
+
+    int rc;
+    int got = 0;
+    if (link.fd < 0)
+        rc = SITECH_NOT_CONNECTED;
+    else if (sendAt > 0 && SiTechHostTime() > sendAt + maxLate)
+        rc = SITECH_TOO_LATE;       // waited behind another exchange past the deadline
+    else
+    {
+        // Late replies go first; a timed exchange must not spend its send time on them
+        if (link.owed > 0)
+            resync(link, (sendAt > 0 && sendAt < link.owedUntil) ? sendAt : link.owedUntil);
+
+        // A timed exchange holds the connection while it waits, so nothing is in flight when it goes out
+        if (sendAt > 0)
+        {
+            sleepUntil(sendAt);
+            start = SiTechHostTime();
+        }
+        sent = SiTechHostTime();
+        rc = writeLines(link, commands, count);
+        while (rc == SITECH_OK && got < count)
+        {
+            rc = readLine(link, replies[got], replyLen, sent + timeout);
+            if (rc == SITECH_OK) got++;
+        }
+        received = SiTechHostTime();
+
+        // The replies we gave up on will still come, ahead of the next exchange's
+        if (rc == SITECH_TIMEOUT || rc == SITECH_OVERFLOW)
+        {
+            link.owed += count - got;
+            if (link.owed > MAX_OWED) link.owed = MAX_OWED;
+            link.owedUntil = received + timeout;
+        }
+    }
+
+    release(link);
+
+    if (sendTime) *sendTime = sent;
+    if (receiveTime) *receiveTime = received;
+    if (results)
+        for (int i = 0; i < count; i++)
+            results[i] = (i < got) ? SITECH_OK : rc;
+
+    std::lock_guard<std::mutex> guard(statsLock);
+    SiTechLaneStats &st = laneStats[lane];
+    st.count++;
+    if (rc != SITECH_OK) st.failures++;
+    st.lastLatency = received - start;
+    if (st.lastLatency > st.maxLatency) st.maxLatency = st.lastLatency;
+    return rc;
+}
+
+int SiTechTransport::writeLines(Link &link, const char *const *commands, int count)
+{
+    char lines[SITECH_LINK_BUFLEN];
+    int len = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int n = snprintf(lines + len, sizeof(lines) - len, "%s\r\n", commands[i]);
+        if (n < 0 || len + n >= (int) sizeof(lines)) return SITECH_OVERFLOW;
+        len += n;
+    }
+
+    int done = 0;
+    while (done < len)
+    {
+        // MSG_NOSIGNAL: a dropped connection is an error, not a SIGPIPE
+        ssize_t n = send(link.fd, lines + done, len - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = write(link.fd, lines + done, len - done);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return SITECH_WRITE_ERROR;
+        }
+        capture.record(linkIndex(link), CAPTURE_SENT, lines + done, n, SiTechHostTime());
+        done += n;
+    }
+    return SITECH_OK;
+}
+
+int SiTechTransport::readLine(Link &link, char *reply, size_t replyLen, double deadline)
+{
+    for (;;)
+    {
+        char *nl = (char *) memchr(link.buf, '\n', link.len);
+        if (nl != NULL)
+        {
+            size_t lineLen = nl - link.buf;
+            size_t used = lineLen + 1;
+            while (lineLen > 0 && (link.buf[lineLen - 1] == '\r' || link.buf[lineLen - 1] == '\n')) lineLen--;
+
+            bool isReply = lineLen >= MIN_REPLY_LEN;
+            if (isReply)
+            {
+                if (lineLen >= replyLen) lineLen = replyLen - 1;
+                memcpy(reply, link.buf, lineLen);
+                reply[lineLen] = '\0';
+            }
+            memmove(link.buf, link.buf + used, link.len - used);
+            link.len -= used;
+            if (isReply) return SITECH_OK;
+            continue;
+        }
+
+        if (link.len == sizeof(link.buf))
+        {
+            link.len = 0;
+            return SITECH_OVERFLOW;
+        }
+
+        int waitMs = (int) ((deadline - SiTechHostTime()) * 1000);
+        if (waitMs <= 0) return SITECH_TIMEOUT;
+
+        struct pollfd pfd;
+        pfd.fd = link.fd;
+        pfd.events = POLLIN;
+        int rc = poll(&pfd, 1, waitMs);
+        if (rc < 0)
+        {
+            if (errno == EINTR) continue;
+            return SITECH_READ_ERROR;
+        }
+        if (rc == 0) return SITECH_TIMEOUT;
+
+        ssize_t n = read(link.fd, link.buf + link.len, sizeof(link.buf) - link.len);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return SITECH_READ_ERROR;
+        }
+        if (n == 0) return SITECH_READ_ERROR;       // SiTechExe closed the connection
+        capture.record(linkIndex(link), CAPTURE_RECEIVED, link.buf + link.len, n, SiTechHostTime());
+        link.len += n;
+    }
+}
+
+/* Read and drop the replies still owed from timed out exchanges, waiting
+ * for them no later than deadline.  Whatever has not come by then is lost. */
+void SiTechTransport::resync(Link &link, double deadline)
+{
+    char line[SITECH_LINK_BUFLEN];
+    while (link.owed > 0 && readLine(link, line, sizeof(line), deadline) == SITECH_OK)
+        link.owed--;
+    link.owed = 0;
+}
+
+bool SiTechTransport::isIdle(SiTechLane lane)
+{
+    Link &link = linkFor(lane);
+    std::lock_guard<std::mutex> guard(link.lock);
+    if (link.busy) return false;
+    for (int i = 0; i < LANE_COUNT; i++)
+        if (link.waiting[i] > 0) return false;
+    return true;
+}
+
+SiTechLaneStats SiTechTransport::stats(SiTechLane lane)
+{
+    std::lock_guard<std::mutex> guard(statsLock);
+    return laneStats[lane];
+}
+
+void SiTechTransport::resetStats()
+{
+    std::lock_guard<std::mutex> guard(statsLock);
+    memset(laneStats, 0, sizeof(laneStats));
+}
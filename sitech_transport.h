@@ -0,0 +1,197 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Request/response transport to SiTechExe with priority lanes.
+ *
+ * SiTechExe answers every command line with one reply line, in order.  A
+ * connection can only carry one exchange at a time, so callers waiting for a
+ * connection are served by lane: safety first, then guiding, control and
+ * telemetry last.  Optionally the safety and guiding lanes get a second,
+ * dedicated connection so an Abort never waits for a status poll that is
+ * sitting out its timeout.
+ *
+ * Several commands can be pipelined: they are written in one send() and the
+ * replies, which SiTechExe returns in order, are handed back in order.  A
+ * batch costs one round trip instead of one per command.
+ *
+ * When an exchange times out its replies are still owed.  Before the next
+ * exchange on that connection they are read and thrown away.  They are waited
+ * for until one more timeout has passed since the exchange gave up; after that
+ * they count as lost, so a reply that never comes cannot shift every later
+ * reply by one.
+ *
+ * Every lane keeps the latency of its last and slowest exchange, measured
+ * from the call to the reply, queueing included.
+ *
+ * All bytes written and read can be recorded to a capture file (see
+ * sitech_capture.h) for replay with sitech_replay.
+ */
+
+#ifndef SITECH_TRANSPORT_H
+#define SITECH_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+
+#include "sitech_capture.h"
+
+enum SiTechLane
+{
+    LANE_SAFETY,        /* Abort, MotorsToBlinky */
+    LANE_GUIDING,       /* PulseGuide, JogArcSeconds */
+    LANE_CONTROL,       /* GoTo, Sync, Park, SetTrackMode ... */
+    LANE_TELEMETRY,     /* ReadScopeStatus and other reads */
+    LANE_COUNT
+};
+
+enum SiTechLinkError
+{
+    SITECH_OK           =  0,
+    SITECH_READ_ERROR   = -1,
+    SITECH_WRITE_ERROR  = -2,
+    SITECH_TIMEOUT      = -3,
+    SITECH_NOT_CONNECTED= -4,
+    SITECH_OVERFLOW     = -5,
+    SITECH_TOO_LATE     = -6        /* a timed exchange got the connection past its deadline, nothing sent */
+};
+
+#define SITECH_LINK_BUFLEN  2048
+
+/* Lane a command belongs to, from its first word; a batch runs on the
+ * highest priority lane of its commands. */
+SiTechLane SiTechLaneFor(const char *command);
+SiTechLane SiTechLaneFor(const char *const *commands, int count);
+const char *SiTechLaneName(SiTechLane lane);
+const char *SiTechLinkErrorString(int err);
+
+struct SiTechLaneStats
+{
+    uint64_t count;
+    uint64_t failures;
+    double lastLatency;         /* seconds */
+    double maxLatency;
+};
+
+class SiTechTransport
+{
+public:
+    SiTechTransport();
+    ~SiTechTransport();
+
+    /* Main connection.  The fd is not closed by the transport. */
+    void attach(int fd);
+    void detach();
+    bool isAttached() const { return mainLink.fd >= 0; }
+
+    /* Main connection opened, and closed, by the transport itself. */
+    bool openMainLink(const char *host, int port, char *err, size_t errLen);
+    void closeMainLink();
+
+    /* Dedicated connection for the safety and guiding lanes. */
+    bool openPriorityLink(const char *host, int port, char *err, size_t errLen);
+    void closePriorityLink();
+    bool hasPriorityLink() const { return priorityLink.fd >= 0; }
+
+    void setTimeout(double seconds) { timeout = seconds; }
+
+    /* Send one command line, wait for its reply line.  The reply is
+     * NUL-terminated without its line ending.  Times are CLOCK_REALTIME
+     * seconds.  Returns SITECH_OK or a SiTechLinkError. */
+    int transact(SiTechLane lane, const char *command, char *reply, size_t replyLen,
+                 double *sendTime = NULL, double *receiveTime = NULL);
+    int transact(const char *command, char *reply, size_t replyLen,
+                 double *sendTime = NULL, double *receiveTime = NULL)
+    {
+        return transact(SiTechLaneFor(command), command, reply, replyLen, sendTime, receiveTime);
+    }
+
+    /* Pipelined exchange: all commands in one write, replies[i] answers
+     * commands[i].  Each reply buffer is replyLen bytes.  The batch runs on
+     * the highest priority lane of its commands unless one is given.  On error
+     * the replies not received are empty.  If results is given, results[i] is
+     * SITECH_OK for every reply that did arrive and the error for the rest;
+     * replies come in order, so those that arrived are always the first ones. */
+    int transactBatch(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                      double *sendTime = NULL, double *receiveTime = NULL, int *results = NULL);
+    int transactBatch(const char *const *commands, int count, char **replies, size_t replyLen,
+                      double *sendTime = NULL, double *receiveTime = NULL, int *results = NULL);
+
+    /* As transactBatch, but the commands are written at host time sendAt
+     * (CLOCK_REALTIME seconds).  The connection is taken first and held
+     * while waiting, so call it shortly before sendAt.  If the connection
+     * only comes free more than maxLate seconds after sendAt nothing is sent
+     * and SITECH_TOO_LATE is returned. */
+    int transactAt(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                   double sendAt, double maxLate, double *sendTime = NULL, double *receiveTime = NULL, int *results = NULL);
+
+    /* True when the connection a lane would use has no exchange in flight
+     * and nobody waiting for it. */
+    bool isIdle(SiTechLane lane);
+
+    SiTechLaneStats stats(SiTechLane lane);
+    void resetStats();
+
+    /* Record every byte on both connections to a new capture file, which must not exist yet. */
+    bool startCapture(const char *path, char *err, size_t errLen) { return capture.open(path, err, errLen); }
+    void stopCapture() { capture.close(); }
+    bool isCapturing() const { return capture.isOpen(); }
+    bool captureFailed() const { return capture.failed(); }
+    uint64_t capturedBytes() const { return capture.recorded(); }
+
+private:
+    struct Link
+    {
+        Link() : fd(-1), owned(false), owed(0), owedUntil(0), len(0), busy(false) { for (int i = 0; i < LANE_COUNT; i++) waiting[i] = 0; }
+        int fd;
+        bool owned;             /* opened by us, closed by us */
+        int owed;               /* replies of timed out exchanges still to come */
+        double owedUntil;       /* host time after which they count as lost */
+        char buf[SITECH_LINK_BUFLEN];
+        size_t len;
+        bool busy;
+        int waiting[LANE_COUNT];
+        std::mutex lock;
+        std::condition_variable cv;
+    };
+
+    Link &linkFor(SiTechLane lane);
+    void acquire(Link &link, SiTechLane lane);
+    void release(Link &link);
+
+    int exchange(SiTechLane lane, const char *const *commands, int count, char **replies, size_t replyLen,
+                 double sendAt, double maxLate, double *sendTime, double *receiveTime, int *results);
+    int writeLines(Link &link, const char *const *commands, int count);
+    int readLine(Link &link, char *reply, size_t replyLen, double deadline);
+    void resync(Link &link, double deadline);
+    void closeLink(Link &link);
+    int linkIndex(const Link &link) const { return &link == &priorityLink ? 1 : 0; }
+
+    Link mainLink;
+    Link priorityLink;
+    double timeout;
+
+    std::mutex statsLock;
+    SiTechLaneStats laneStats[LANE_COUNT];
+
+    SiTechCaptureWriter capture;
+};
+
+#endif // SITECH_TRANSPORT_H
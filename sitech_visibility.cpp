@@ -0,0 +1,180 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "sitech_visibility.h"
+
+#define DEG2RAD             (M_PI / 180.0)
+#define RAD2DEG             (180.0 / M_PI)
+#define SIDEREAL_PER_SOLAR  1.00273790935           /* sidereal hours per solar hour */
+#define VIS_BLOCK           256                     /* targets per block, sized to stay in L1 */
+
+double SiTechAirmass(double altDeg)
+{
+    if (altDeg <= -6.07995 + 1e-6) return 0;
+    return 1.0 / (sin(altDeg * DEG2RAD) + 0.50572 * pow(altDeg + 6.07995, -1.6364));
+}
+
+/* sin(alt) for a block at one sidereal time.  Plain loop over separate arrays,
+ * no aliasing, no calls: this is the part the compiler turns into SIMD. */
+static void blockSinAlt(const float * __restrict__ a, const float * __restrict__ b,
+                        const float * __restrict__ cosRA, const float * __restrict__ sinRA,
+                        float cosLST, float sinLST, int m, float * __restrict__ sinAlt)
+{
+    for (int i = 0; i < m; i++)
+        sinAlt[i] = a[i] + b[i] * (cosLST * cosRA[i] + sinLST * sinRA[i]);
+}
+
+/* 1 = clearly above the whole mask, 0 = clearly below all of it, 2 = needs azimuth. */
+static void blockClassify(const float * __restrict__ sinAlt, float sinLo, float sinHi, int m,
+                          unsigned char * __restrict__ state)
+{
+    for (int i = 0; i < m; i++)
+        state[i] = (sinAlt[i] >= sinHi) ? 1 : ((sinAlt[i] >= sinLo) ? 2 : 0);
+}
+
+static void blockTrackMax(const float * __restrict__ sinAlt, float t, int m,
+                          float * __restrict__ maxSinAlt, float * __restrict__ bestT)
+{
+    for (int i = 0; i < m; i++)
+    {
+        bool higher = sinAlt[i] > maxSinAlt[i];
+        maxSinAlt[i] = higher ? sinAlt[i] : maxSinAlt[i];
+        bestT[i] = higher ? t : bestT[i];
+    }
+}
+
+void SiTechScreenTargets(const double *ra, const double *dec, size_t n,
+                         const SiTechVisibilityWindow &window, const SiTechHorizonMask &mask,
+                         SiTechVisibility *out)
+{
+    double stepHours = window.stepMinutes / 60.0;
+    if (stepHours <= 0) stepHours = 1.0 / 60.0;
+    int steps = (int) ceil(window.windowHours / stepHours);
+    if (steps < 0) steps = 0;
+
+    double sinLat = sin(window.latitude * DEG2RAD);
+    double cosLat = cos(window.latitude * DEG2RAD);
+    float sinLo = (float) sin(mask.lowestLimit() * DEG2RAD);
+    float sinHi = (float) sin(mask.highestLimit() * DEG2RAD);
+
+    float a[VIS_BLOCK], b[VIS_BLOCK], cosRA[VIS_BLOCK], sinRA[VIS_BLOCK];
+    float sinDec[VIS_BLOCK], cosDec[VIS_BLOCK];
+    float sinAlt[VIS_BLOCK], prevSinAlt[VIS_BLOCK];
+    float maxSinAlt[VIS_BLOCK], bestT[VIS_BLOCK], bestVisible[VIS_BLOCK];
+    unsigned char state[VIS_BLOCK], prevUp[VIS_BLOCK];
+    int upCount[VIS_BLOCK];
+
+    for (size_t first = 0; first < n; first += VIS_BLOCK)
+    {
+        int m = (n - first < VIS_BLOCK) ? (int) (n - first) : VIS_BLOCK;
+        SiTechVisibility *row = out + first;
+
+        for (int i = 0; i < m; i++)
+        {
+            double r = ra[first + i] * 15.0 * DEG2RAD;
+            double d = dec[first + i] * DEG2RAD;
+            sinDec[i] = (float) sin(d);
+            cosDec[i] = (float) cos(d);
+            a[i] = (float) (sinLat * sinDec[i]);
+            b[i] = (float) (cosLat * cosDec[i]);
+            cosRA[i] = (float) cos(r);
+            sinRA[i] = (float) sin(r);
+            maxSinAlt[i] = -2;
+            bestT[i] = 0;
+            bestVisible[i] = -2;
+            upCount[i] = 0;
+            prevUp[i] = 0;
+            row[i].riseHours = -1;
+            row[i].setHours = -1;
+            row[i].flags = 0;
+        }
+
+        for (int s = 0; s <= steps; s++)
+        {
+            double t = s * stepHours;
+            if (t > window.windowHours) t = window.windowHours;
+            double lst = (window.startLST + t * SIDEREAL_PER_SOLAR) * 15.0 * DEG2RAD;
+            float cosLST = (float) cos(lst), sinLST = (float) sin(lst);
+
+            blockSinAlt(a, b, cosRA, sinRA, cosLST, sinLST, m, sinAlt);
+            blockClassify(sinAlt, sinLo, sinHi, m, state);
+            blockTrackMax(sinAlt, (float) t, m, maxSinAlt, bestT);
+
+            for (int i = 0; i < m; i++)
+            {
+                bool up = state[i] == 1;
+                bool edge = false;
+                double limit = 0;
+
+                // Only here do we pay for an azimuth: the altitude is inside the mask's range
+                if (state[i] == 2)
+                {
+                    double sinHA = sinLST * cosRA[i] - cosLST * sinRA[i];
+                    double cosHA = cosLST * cosRA[i] + sinLST * sinRA[i];
+                    double az = atan2(-cosDec[i] * sinHA, sinDec[i] * cosLat - cosDec[i] * cosHA * sinLat) * RAD2DEG;
+                    limit = mask.limitAt(az);
+                    up = asin(sinAlt[i]) * RAD2DEG >= limit;
+                    edge = true;
+                }
+
+                if (s == 0)
+                {
+                    if (up) { row[i].riseHours = 0; row[i].flags |= VIS_UP_AT_START; }
+                }
+                else if (up != (prevUp[i] != 0))
+                {
+                    // Interpolate the crossing within the step against the local mask altitude
+                    if (!edge) limit = up ? mask.lowestLimit() : mask.highestLimit();
+                    double sinLimit = sin(limit * DEG2RAD);
+                    double span = sinAlt[i] - prevSinAlt[i];
+                    double frac = (span != 0) ? (sinLimit - prevSinAlt[i]) / span : 1;
+                    if (frac < 0) frac = 0;
+                    if (frac > 1) frac = 1;
+                    float when = (float) (t - stepHours + frac * stepHours);
+                    if (up && row[i].riseHours < 0) row[i].riseHours = when;
+                    if (!up && row[i].riseHours >= 0 && row[i].setHours < 0) row[i].setHours = when;
+                }
+
+                if (up)
+                {
+                    upCount[i]++;
+                    if (sinAlt[i] > bestVisible[i]) bestVisible[i] = sinAlt[i];
+                }
+                prevUp[i] = up ? 1 : 0;
+                prevSinAlt[i] = sinAlt[i];
+            }
+        }
+
+        for (int i = 0; i < m; i++)
+        {
+            row[i].maxAltitude = (float) (asin(maxSinAlt[i] > 1 ? 1 : maxSinAlt[i]) * RAD2DEG);
+            row[i].bestHours = bestT[i];
+            row[i].minAirmass = (upCount[i] > 0) ? (float) SiTechAirmass(asin(bestVisible[i] > 1 ? 1 : bestVisible[i]) * RAD2DEG) : 0;
+
+            if (upCount[i] == 0) row[i].flags |= VIS_NEVER_UP;
+            if (upCount[i] == steps + 1) row[i].flags |= VIS_ALWAYS_UP;
+            if (prevUp[i])
+            {
+                row[i].flags |= VIS_UP_AT_END;
+                if (row[i].setHours < 0) row[i].setHours = (float) window.windowHours;
+            }
+        }
+    }
+}
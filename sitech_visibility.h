@@ -0,0 +1,87 @@
+/*******************************************************************************
+ Copyright(c) 2015 Jasem Mutlaq. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/* Bulk visibility screening of target lists.
+ *
+ * For every RA/Dec target, step through a time window and find when it is
+ * above the horizon mask, its highest altitude and the airmass there.  Targets
+ * are processed in blocks laid out as separate arrays so the per-step work,
+ *
+ *     sin(alt) = sin(lat) sin(dec) + cos(lat) cos(dec) (cos(lst) cos(ra) + sin(lst) sin(ra))
+ *
+ * is two multiply-adds per target with no trigonometry, and the compiler
+ * vectorises it.  Azimuth (atan2) is only computed for targets whose altitude
+ * falls between the lowest and highest point of the mask.
+ */
+
+#ifndef SITECH_VISIBILITY_H
+#define SITECH_VISIBILITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sitech_horizon.h"
+
+#define VIS_UP_AT_START     1
+#define VIS_UP_AT_END       2
+#define VIS_NEVER_UP        4
+#define VIS_ALWAYS_UP       8
+
+/* One row of the visibility table, 24 bytes.  Times are hours from the window start. */
+struct SiTechVisibility
+{
+    float riseHours;        /* first time it comes above the mask, 0 if up at start, -1 never */
+    float setHours;         /* first time it goes below the mask after rising, window length if it stays up, -1 never up */
+    float maxAltitude;      /* degrees, highest point in the window whether visible or not */
+    float bestHours;        /* when the highest point is reached */
+    float minAirmass;       /* airmass at the highest visible point, 0 if never up */
+    uint32_t flags;         /* VIS_* */
+};
+
+/* Table header for the VISIBILITY_TABLE BLOB, followed by count rows in target order. */
+#define VIS_TABLE_MAGIC     0x53564953      /* "SVIS" */
+#define VIS_TABLE_VERSION   1
+struct SiTechVisibilityHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t rowSize;
+    double startTime;       /* unix seconds of the window start */
+    double startLST;        /* local sidereal time at the window start, hours */
+    double windowHours;
+    double stepMinutes;
+};
+
+struct SiTechVisibilityWindow
+{
+    double startLST;        /* hours */
+    double latitude;        /* degrees */
+    double windowHours;
+    double stepMinutes;
+};
+
+/* Screen n targets (RA hours, Dec degrees).  out must hold n rows. */
+void SiTechScreenTargets(const double *ra, const double *dec, size_t n,
+                         const SiTechVisibilityWindow &window, const SiTechHorizonMask &mask,
+                         SiTechVisibility *out);
+
+/* Kasten & Young airmass for an altitude in degrees. */
+double SiTechAirmass(double altDeg);
+
+#endif // SITECH_VISIBILITY_H
@@ -24,6 +24,7 @@ localport
 1956
 1929
 */
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,11 +33,19 @@ localport
 #include <sys/time.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
 
+#include <cmath>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "telescope_sitech.h"
 #include "indicom.h"
@@ -55,6 +64,8 @@ std::unique_ptr<ScopeSiTech> telescope_sitech(new ScopeSiTech());
 #define FINE_SLEW_LIMIT 0.5                             /* Move at FINE_SLEW_RATE until distance from target is FINE_SLEW_LIMIT degrees */
 
 #define	POLLMS		250				/* poll period, ms */
+#define SLEW_SETTLE     10                              /* default seconds a GoTo takes on top of the move itself */
+#define SLEW_START_WAIT 10                              /* give up timing a GoTo whose slewing bit never showed, s */
 
 #define RA_AXIS         0
 #define DEC_AXIS        1
@@ -63,8 +74,21 @@ std::unique_ptr<ScopeSiTech> telescope_sitech(new ScopeSiTech());
 #define GUIDE_WEST      0
 #define GUIDE_EAST      1
 
-#define MIN_AZ_FLIP     180
-#define MAX_AZ_FLIP     200
+#define FLIP_HA_LIMIT   5                               /* default degrees past the meridian before a GEM must flip */
+#define LIMIT_SEARCH_HOURS 12                           /* how far ahead to look for the horizon limit */
+#define LIMITS_TAB      "Limits"
+#define PE_TAB          "Periodic Error"
+#define PE_REPORT_SECONDS 5                             /* how often tracking error properties are sent */
+#define PLANNING_TAB    "Planning"
+#define CENTER_TAB      "Centering"
+#define CAPTURE_DIR     ".indi/sitech_captures"           /* under $HOME, the only place captures are written */
+#define CENTER_SOLVER_ENV "SITECH_CENTER_SOLVER"           /* environment variable naming the solver program */
+#define CENTER_SOLVER_TIMEOUT 120                       /* seconds a solver may run before it is killed */
+#define CENTER_SOLVER_REAP_MS 100                       /* exit poll once the solver closed its output */
+#define SCHEDULE_TAB    "Schedule"
+#define SCHEDULE_TOLERANCE_MS 10                        /* fire time error above which a scheduled command is flagged */
+#define SETTINGS_COALESCE_MS 100                        /* how long setting changes are gathered before one is sent */
+#define SIDEREAL_PER_SOLAR 1.00273790935
 
 #define MYSCOPE "SiTechScopeA"
 #define NAD -99999999.99
@@ -77,7 +101,6 @@ std::unique_ptr<ScopeSiTech> telescope_sitech(new ScopeSiTech());
 
 
 void ISPoll(void *p);
-void DansLog(char * stg);
 
 
 void ISGetProperties(const char *dev)
@@ -102,24 +125,62 @@ void ISNewNumber(const char *dev, const char *name, double values[], char *names
 
 void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
 {
-  INDI_UNUSED(dev);
-  INDI_UNUSED(name);
-  INDI_UNUSED(sizes);
-  INDI_UNUSED(blobsizes);
-  INDI_UNUSED(blobs);
-  INDI_UNUSED(formats);
-  INDI_UNUSED(names);
-  INDI_UNUSED(n);
+        telescope_sitech->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, n);
 }
 void ISSnoopDevice (XMLEle *root)
 {
    telescope_sitech->ISSnoopDevice(root);
 }
-ScopeSiTech::ScopeSiTech()
+ScopeSiTech::ScopeSiTech() : transport(mount.transport()), scheduler(transport), slewHistory(SLEW_SETTLE, GOTO_RATE)
 {
     //ctor
     currentRA=0;
     currentDEC=60;
+    currentAlt=0;
+    currentAz=0;
+    axisPositionDegsPrimary=0;
+    axisPositionDegsSecondary=0;
+    scopeSiderealTime=0;
+    scopeJulianDay=0;
+    scopeTime=0;
+    scopeStatusBits=0;
+    scopeSiteLatitude=0;
+    lastSendTime=0;
+    lastReceiveTime=0;
+    sampleTime=0;
+    lastClockReport=0;
+    slewTimed=false;
+    slewSeen=false;
+    slewStartTime=0;
+    slewDistance=0;
+    slewEstimate=0;
+    lastLaneCount=0;
+    abortReceived=0;
+    abortLatency=abortMaxLatency=0;
+    abortCount=0;
+    statusCB=0;
+    lastPollSend=0;
+    reportedPollError=SITECH_OK;
+    guideNSTimerID=0;
+    guideWETimerID=0;
+    currentTrackMode=-1;
+    analysedTrackMode=-1;
+    analysedAxis=-1;
+    analysedAxisStart[0]=analysedAxisStart[1]=0;
+    analysedTimeStart=0;
+    lastPEReport=0;
+    haveScopeSiteLocation=false;
+    centerMethod=CENTER_JOG;
+    centerMoveDistance=0;
+    centerSolverPid=-1;
+    centerSolverFd=-1;
+    centerSolverCB=0;
+    centerSolverTimerID=0;
+    centerSolverReapID=0;
+    centerSolverLen=0;
+    requestedTrackMode=-1;
+    settingsTimerID=0;
+    scheduleCB=0;
 
     DBG_SCOPE = INDI::Logger::getInstance().addDebugLevel("Scope Verbose", "SCOPE");   
 
@@ -128,7 +189,6 @@ ScopeSiTech::ScopeSiTech()
 
     /* initialize random seed: */
       srand ( time(NULL) );
-      printf("Hellothere!\n");
 }
 
 ScopeSiTech::~ScopeSiTech()
@@ -143,7 +203,6 @@ const char * ScopeSiTech::getDefaultName()
 //192.168.51.511956 
 bool ScopeSiTech::initProperties()
 {
-//    DansLog((char * ) "InitProperties");
     /* Make sure to init parent properties first */
     INDI::Telescope::initProperties();
 
@@ -171,6 +230,114 @@ bool ScopeSiTech::initProperties()
     IUFillNumber(&TrackRateN[1],"TRACK_RATE_DE","DE (arcsecs/s)","%.6f",-16384.0, 16384.0, 0.000001, 0);
     IUFillNumberVector(&TrackRateNP, TrackRateN,2,getDeviceName(),"TELESCOPE_TRACK_RATE","Track Rates", MAIN_CONTROL_TAB, IP_RW,60,IPS_IDLE);
 
+    // Host/mount clock estimate
+    IUFillNumber(&ClockSyncN[0], "CLOCK_OFFSET", "Mount - host (ms)", "%.1f", -1e9, 1e9, 0, 0);
+    IUFillNumber(&ClockSyncN[1], "CLOCK_DRIFT", "Drift (ppm)", "%.2f", -1000, 1000, 0, 0);
+    IUFillNumber(&ClockSyncN[2], "LINK_RTT", "Round trip (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumber(&ClockSyncN[3], "LINK_RTT_MIN", "Min round trip (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&ClockSyncNP, ClockSyncN, 4, getDeviceName(), "CLOCK_SYNC", "Mount Clock", OPTIONS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Where the current GoTo ends, for the dome, and how long it should take
+    IUFillNumber(&SlewDestinationN[0], "DEST_RA", "RA (hh:mm:ss)", "%010.6m", 0, 24, 0, 0);
+    IUFillNumber(&SlewDestinationN[1], "DEST_DEC", "DEC (dd:mm:ss)", "%010.6m", -90, 90, 0, 0);
+    IUFillNumber(&SlewDestinationN[2], "DEST_ALT", "Alt (dd:mm:ss)", "%010.6m", -90, 90, 0, 0);
+    IUFillNumber(&SlewDestinationN[3], "DEST_AZ", "Az (dd:mm:ss)", "%010.6m", 0, 360, 0, 0);
+    IUFillNumber(&SlewDestinationN[4], "SLEW_ETA", "Time left (s)", "%.1f", 0, 3600, 0, 0);
+    IUFillNumberVector(&SlewDestinationNP, SlewDestinationN, 5, getDeviceName(), "SLEW_DESTINATION", "Slew Destination", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Second connection to SiTechExe reserved for Abort and guiding
+    IUFillSwitch(&PriorityLinkS[0], "PRIORITY_LINK_ON", "On", ISS_OFF);
+    IUFillSwitch(&PriorityLinkS[1], "PRIORITY_LINK_OFF", "Off", ISS_ON);
+    IUFillSwitchVector(&PriorityLinkSP, PriorityLinkS, 2, getDeviceName(), "PRIORITY_LINK", "Priority Link", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+    IUFillNumber(&LaneLatencyN[0], "SAFETY_LAST", "Abort last (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumber(&LaneLatencyN[1], "SAFETY_MAX", "Abort max (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumber(&LaneLatencyN[2], "GUIDING_LAST", "Guide last (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumber(&LaneLatencyN[3], "GUIDING_MAX", "Guide max (ms)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&LaneLatencyNP, LaneLatencyN, 4, getDeviceName(), "LANE_LATENCY", "Command Latency", OPTIONS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Raw record of the SiTechExe traffic, for sitech_replay.  The driver names the file.
+    IUFillSwitch(&CaptureS[0], "CAPTURE_ON", "On", ISS_OFF);
+    IUFillSwitch(&CaptureS[1], "CAPTURE_OFF", "Off", ISS_ON);
+    IUFillSwitchVector(&CaptureSP, CaptureS, 2, getDeviceName(), "SESSION_CAPTURE", "Capture", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+    IUFillText(&CaptureFileT[0], "CAPTURE_FILE", "File", "");
+    IUFillTextVector(&CaptureFileTP, CaptureFileT, 1, getDeviceName(), "SESSION_CAPTURE_FILE", "Capture File", OPTIONS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Tracking error from the axis angles against the rate we asked for
+    IUFillNumber(&TrackingErrorN[0], "RATE_ERROR", "Rate error (\"/s)", "%.4f", -1000, 1000, 0, 0);
+    IUFillNumber(&TrackingErrorN[1], "PE_RMS", "Periodic RMS (\")", "%.2f", 0, 10000, 0, 0);
+    IUFillNumber(&TrackingErrorN[2], "PE_WINDOW_FILL", "Window (%)", "%.0f", 0, 100, 0, 0);
+    IUFillNumberVector(&TrackingErrorNP, TrackingErrorN, 3, getDeviceName(), "TRACKING_ERROR", "Tracking Error", PE_TAB, IP_RO, 0, IPS_IDLE);
+
+    char peName[MAXINDINAME], peLabel[MAXINDILABEL];
+    for (int i = 0; i < PE_PEAKS; i++)
+    {
+        snprintf(peName, MAXINDINAME, "PE_PERIOD_%d", i + 1);
+        snprintf(peLabel, MAXINDILABEL, "Period %d (s)", i + 1);
+        IUFillNumber(&PESpectrumN[i * 2], peName, peLabel, "%.1f", 0, 100000, 0, 0);
+        snprintf(peName, MAXINDINAME, "PE_AMPLITUDE_%d", i + 1);
+        snprintf(peLabel, MAXINDILABEL, "Amplitude %d (\")", i + 1);
+        IUFillNumber(&PESpectrumN[i * 2 + 1], peName, peLabel, "%.2f", 0, 10000, 0, 0);
+    }
+    IUFillNumberVector(&PESpectrumNP, PESpectrumN, PE_PEAKS * 2, getDeviceName(), "PE_SPECTRUM", "PE Spectrum", PE_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Off-mount visibility screening of target lists
+    IUFillNumber(&VisibilityWindowN[0], "VIS_START", "Start from now (h)", "%.2f", -24, 48, 0.25, 0);
+    IUFillNumber(&VisibilityWindowN[1], "VIS_DURATION", "Duration (h)", "%.2f", 0, 24, 0.25, 12);
+    IUFillNumber(&VisibilityWindowN[2], "VIS_STEP", "Step (min)", "%.1f", 0.5, 60, 0.5, 5);
+    IUFillNumberVector(&VisibilityWindowNP, VisibilityWindowN, 3, getDeviceName(), "VISIBILITY_WINDOW", "Window", PLANNING_TAB, IP_RW, 0, IPS_IDLE);
+    IUFillBLOB(&VisibilityTargetsB[0], "VIS_TARGETS", "Targets", "");
+    IUFillBLOBVector(&VisibilityTargetsBP, VisibilityTargetsB, 1, getDeviceName(), "VISIBILITY_TARGETS", "Targets", PLANNING_TAB, IP_WO, 60, IPS_IDLE);
+    IUFillBLOB(&VisibilityTableB[0], "VIS_TABLE", "Table", "");
+    IUFillBLOBVector(&VisibilityTableBP, VisibilityTableB, 1, getDeviceName(), "VISIBILITY_TABLE", "Visibility", PLANNING_TAB, IP_RO, 60, IPS_IDLE);
+
+    // Closed-loop centering: the measured offset comes from a client or a local solver program.
+    // The solver is set where the driver is started, never by a client, since the driver runs it.
+    IUFillNumber(&CenterOffsetN[0], "CENTER_RA_OFFSET", "RA offset (\")", "%.2f", -36000, 36000, 0, 0);
+    IUFillNumber(&CenterOffsetN[1], "CENTER_DEC_OFFSET", "Dec offset (\")", "%.2f", -36000, 36000, 0, 0);
+    IUFillNumberVector(&CenterOffsetNP, CenterOffsetN, 2, getDeviceName(), "CENTER_OFFSET", "Target Offset", CENTER_TAB, IP_RW, 0, IPS_IDLE);
+    const char *solver = getenv(CENTER_SOLVER_ENV);
+    IUFillText(&CenterSolverT[0], "SOLVER_COMMAND", "Program", solver ? solver : "");
+    IUFillTextVector(&CenterSolverTP, CenterSolverT, 1, getDeviceName(), "CENTER_SOLVER", "Solver", CENTER_TAB, IP_RO, 0,
+                     (CenterSolverT[0].text[0] == '\0') ? IPS_IDLE : IPS_OK);
+    IUFillNumber(&CenterSettingsN[0], "CENTER_TOLERANCE", "Tolerance (\")", "%.1f", 0.1, 600, 0.5, 2);
+    IUFillNumber(&CenterSettingsN[1], "CENTER_ITERATIONS", "Max corrections", "%.0f", 1, 20, 1, 5);
+    IUFillNumberVector(&CenterSettingsNP, CenterSettingsN, 2, getDeviceName(), "CENTER_SETTINGS", "Settings", CENTER_TAB, IP_RW, 0, IPS_IDLE);
+    IUFillSwitch(&CenterS[0], "CENTER_START", "Start", ISS_OFF);
+    IUFillSwitch(&CenterS[1], "CENTER_STOP", "Stop", ISS_ON);
+    IUFillSwitchVector(&CenterSP, CenterS, 2, getDeviceName(), "CENTER_CONTROL", "Centering", CENTER_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+    IUFillNumber(&CenterStatusN[0], "CENTER_ITERATION", "Corrections", "%.0f", 0, 100, 0, 0);
+    IUFillNumber(&CenterStatusN[1], "CENTER_ERROR", "Last error (\")", "%.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&CenterStatusN[2], "CENTER_ELAPSED", "Elapsed (s)", "%.1f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&CenterStatusNP, CenterStatusN, 3, getDeviceName(), "CENTER_STATUS", "Status", CENTER_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Commands fired at a UTC instant on the mount clock
+    IUFillText(&ScheduleCommandT[0], "SCHEDULE_UTC", "UTC (YYYY-MM-DDTHH:MM:SS.sss)", "");
+    IUFillText(&ScheduleCommandT[1], "SCHEDULE_CMD", "Command", "");
+    IUFillTextVector(&ScheduleCommandTP, ScheduleCommandT, 2, getDeviceName(), "SCHEDULE_COMMAND", "Schedule", SCHEDULE_TAB, IP_RW, 0, IPS_IDLE);
+    IUFillSwitch(&ScheduleClearS[0], "SCHEDULE_CLEAR", "Clear", ISS_OFF);
+    IUFillSwitchVector(&ScheduleClearSP, ScheduleClearS, 1, getDeviceName(), "SCHEDULE_CONTROL", "Queue", SCHEDULE_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+    IUFillText(&ScheduleNextT[0], "NEXT_UTC", "UTC", "");
+    IUFillText(&ScheduleNextT[1], "NEXT_CMD", "Command", "");
+    IUFillTextVector(&ScheduleNextTP, ScheduleNextT, 2, getDeviceName(), "SCHEDULE_NEXT", "Next", SCHEDULE_TAB, IP_RO, 0, IPS_IDLE);
+    IUFillNumber(&ScheduleResultN[0], "SCHEDULE_PENDING", "Pending", "%.0f", 0, SCHEDULE_MAX, 0, 0);
+    IUFillNumber(&ScheduleResultN[1], "FIRE_ERROR", "Last fire error (ms)", "%.2f", -1e6, 1e6, 0, 0);
+    IUFillNumber(&ScheduleResultN[2], "FIRE_RTT", "Last round trip (ms)", "%.2f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&ScheduleResultNP, ScheduleResultN, 3, getDeviceName(), "SCHEDULE_RESULT", "Result", SCHEDULE_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Horizon mask file, alt/az pairs
+    IUFillText(&HorizonFileT[0], "HORIZON_FILE", "File", "");
+    IUFillTextVector(&HorizonFileTP, HorizonFileT, 1, getDeviceName(), "HORIZON_MASK", "Horizon Mask", LIMITS_TAB, IP_RW, 0, IPS_IDLE);
+
+    // How far past the meridian a GEM may track before it must flip
+    IUFillNumber(&FlipLimitN[0], "FLIP_HA", "Past meridian (deg)", "%.2f", 0, 30, 0.5, FLIP_HA_LIMIT);
+    IUFillNumberVector(&FlipLimitNP, FlipLimitN, 1, getDeviceName(), "MERIDIAN_FLIP", "Meridian Flip", LIMITS_TAB, IP_RW, 0, IPS_IDLE);
+
+    // Time left while tracking, -1 if not applicable
+    IUFillNumber(&LimitTimesN[0], "TIME_TO_LIMIT", "To horizon (min)", "%.1f", -1, 1440, 0, -1);
+    IUFillNumber(&LimitTimesN[1], "TIME_TO_FLIP", "To flip (min)", "%.1f", -1, 1440, 0, -1);
+    IUFillNumberVector(&LimitTimesNP, LimitTimesN, 2, getDeviceName(), "LIMIT_TIMES", "Time Until", LIMITS_TAB, IP_RO, 0, IPS_IDLE);
+
      // Let's simulate it to be an F/7.5 120mm telescope
     ScopeParametersN[0].value = 120;
     ScopeParametersN[1].value = 900;
@@ -187,7 +354,6 @@ bool ScopeSiTech::initProperties()
     addDebugControl();
 
     setDriverInterface(getDriverInterface() | GUIDER_INTERFACE);
-//    DansLog((char * ) "InitProperties--Done");
 
     return true;
 }
@@ -197,14 +363,15 @@ void ScopeSiTech::ISGetProperties (const char *dev)
     /* First we let our parent populate */
     INDI::Telescope::ISGetProperties(dev);
 
+    // Available before connecting so the handshake can be captured too
+    defineSwitch(&CaptureSP);
+    defineText(&CaptureFileTP);
+
     if(isConnected())
     {
         defineNumber(&GuideNSNP);
         defineNumber(&GuideWENP);
         defineNumber(&GuideRateNP);
-//        defineNumber(&EqPENV);
-//        defineSwitch(&PEErrNSSP);
-//        defineSwitch(&PEErrWESP);
     }
 
 
@@ -236,9 +403,60 @@ bool ScopeSiTech::updateProperties()
         defineNumber(&GuideWENP);
         defineNumber(&GuideRateNP);
 
+        defineNumber(&SlewDestinationNP);
+        defineNumber(&ClockSyncNP);
+        defineSwitch(&PriorityLinkSP);
+        defineNumber(&LaneLatencyNP);
+        defineNumber(&TrackingErrorNP);
+        defineNumber(&PESpectrumNP);
+        defineNumber(&VisibilityWindowNP);
+        defineBLOB(&VisibilityTargetsBP);
+        defineBLOB(&VisibilityTableBP);
+        defineSwitch(&CenterSP);
+        defineNumber(&CenterOffsetNP);
+        defineText(&CenterSolverTP);
+        defineNumber(&CenterSettingsNP);
+        defineNumber(&CenterStatusNP);
+        defineText(&ScheduleCommandTP);
+        defineSwitch(&ScheduleClearSP);
+        defineText(&ScheduleNextTP);
+        defineNumber(&ScheduleResultNP);
+        defineText(&HorizonFileTP);
+        defineNumber(&FlipLimitNP);
+        defineNumber(&LimitTimesNP);
     }
     else
     {
+        deleteProperty(SlewDestinationNP.name);
+        deleteProperty(ClockSyncNP.name);
+        deleteProperty(PriorityLinkSP.name);
+        deleteProperty(LaneLatencyNP.name);
+        deleteProperty(TrackingErrorNP.name);
+        deleteProperty(PESpectrumNP.name);
+        deleteProperty(VisibilityWindowNP.name);
+        deleteProperty(VisibilityTargetsBP.name);
+        deleteProperty(VisibilityTableBP.name);
+        stopCenterSolver();
+        centerer.stop();
+        pendingSettings.clear();
+        if (settingsTimerID > 0) IERmTimer(settingsTimerID);
+        settingsTimerID = 0;
+        deleteProperty(CenterSP.name);
+        deleteProperty(CenterOffsetNP.name);
+        deleteProperty(CenterSolverTP.name);
+        deleteProperty(CenterSettingsNP.name);
+        deleteProperty(CenterStatusNP.name);
+        if (scheduleCB > 0) IERmCallback(scheduleCB);
+        scheduleCB = 0;
+        scheduler.stop();
+        deleteProperty(ScheduleCommandTP.name);
+        deleteProperty(ScheduleClearSP.name);
+        deleteProperty(ScheduleNextTP.name);
+        deleteProperty(ScheduleResultNP.name);
+        deleteProperty(HorizonFileTP.name);
+        deleteProperty(FlipLimitNP.name);
+        deleteProperty(LimitTimesNP.name);
+
         deleteProperty(TrackModeSP.name);
         deleteProperty(TrackRateNP.name);
 
@@ -250,55 +468,28 @@ bool ScopeSiTech::updateProperties()
     return true;
 }
 #define MAXSOCKETBUFLEN 512
-#define SITECHTIMEOUT 3
-static char SendBuf[MAXSOCKETBUFLEN];
+#define MAXBATCH 4
 static char RcvBuf[MAXSOCKETBUFLEN];
-static char myLogStg[1000];
-static ofstream myDbgFile;
-void DansLog(char * stg)
-{
-    if(true)
-    {
-    myDbgFile.open("/tmp/DansDebug",ios::app );
-    myDbgFile << stg;
-    myDbgFile << "\n";
-    myDbgFile.close();
-    }
-}
+static char BatchBuf[MAXBATCH][MAXSOCKETBUFLEN];
 bool ScopeSiTech::Handshake()
 {
-    int rc=0, nbytes_written=0, nbytes_read=0;
-//    DansLog((char * ) "StartHandshake");
-    memset(SendBuf,'\0',MAXSOCKETBUFLEN);
-    memset(RcvBuf,'\0',MAXSOCKETBUFLEN);
-    strncpy(SendBuf, "ReadScopeStatus\r\n", MAXSOCKETBUFLEN);
-
-    DEBUGF(INDI::Logger::DBG_DEBUG, "CMD: %s", SendBuf);
-//    sprintf(myLogStg,"inHandShk. SendBuf=%s", SendBuf);DansLog(myLogStg);
-
-    if ( (rc = tty_write_string(PortFD, SendBuf, &nbytes_written)) != TTY_OK)
-    {
-//        sprintf(myLogStg,"inHandShk.WriteError. nbyteswritted=%d", nbytes_written);DansLog(myLogStg);
-        DEBUG(INDI::Logger::DBG_ERROR, "Error writing to the SiTechExe TCP server.");
-        return false;
-    }
-//    sprintf(myLogStg,"inHandShk.Normal. nbyteswritted=%d rc=%d", nbytes_written, rc);DansLog(myLogStg);
-
-    int rcr = tty_read_section(PortFD, RcvBuf, '\n', SITECHTIMEOUT, &nbytes_read);
-
-//    if ( (rc == rcr ) != TTY_OK)
-    if ( rcr != TTY_OK)
+    mount.attach(PortFD);
+    mountClock.reset();
+
+    DEBUG(INDI::Logger::DBG_DEBUG, "CMD: ReadScopeStatus, SiteLocations");
+    const char *cmds[2] = { "ReadScopeStatus", "SiteLocations" };
+    char *replies[2];
+    int got = GetStringsFromSerial(cmds, 2, replies);
+    if (got < 1)
     {
-//        sprintf(myLogStg,"inHandShk.ReadError. nbytesread=%d rcr=%d rs=%s", nbytes_read,rcr,RcvBuf);DansLog(myLogStg);
         DEBUG(INDI::Logger::DBG_ERROR, "Error reading from SiTechExe TCP server.");
+        mount.disconnect();
         return false;
     }
-
+    strncpy(RcvBuf, replies[0], MAXSOCKETBUFLEN);
     DEBUGF(INDI::Logger::DBG_DEBUG, "RES: %s", RcvBuf);
 
-//    sprintf(myLogStg,"inHandShk.B4SetupVars. nbytesread=%d rcr=%d rs=%s", nbytes_read,rcr,RcvBuf);DansLog(myLogStg);
     SetUpVarsFromReturnString(RcvBuf, true);
-    sprintf(myLogStg,"inHandShkAfterSetupVars. RA=%f rcvBuf=%s",currentRA,RcvBuf);DansLog(myLogStg);
     if (!IsCommunicatingWithController)
     {
         DEBUG(INDI::Logger::DBG_ERROR, "No Communication From SiTechExe To Controller!");
@@ -314,6 +505,43 @@ bool ScopeSiTech::Handshake()
         DEBUG(INDI::Logger::DBG_ERROR, tst );
     }
 
+    if (!statusSegment.isOpen())
+    {
+        char shmName[128];
+        SiTechShmName(getDeviceName(), shmName, sizeof(shmName));
+        if (statusSegment.open(shmName))
+            DEBUGF(INDI::Logger::DBG_SESSION, "Publishing mount status to shared memory %s", shmName);
+        else
+            DEBUGF(INDI::Logger::DBG_WARNING, "Cannot create shared memory segment %s: %s", shmName, strerror(errno));
+    }
+    publishStatusSegment();
+
+    if (got < 2 || !readSiteLocation(replies[1]))
+        DEBUG(INDI::Logger::DBG_WARNING, "Cannot read site location from SiTechExe, using the INDI site latitude.");
+
+    transport.resetStats();
+    abortLatency = abortMaxLatency = 0;
+    abortCount = 0;
+    if (PriorityLinkS[0].s == ISS_ON)
+        setPriorityLink(true);
+
+    char err[MAXRBUF];
+    if (scheduler.start(err, sizeof(err)))
+    {
+        if (scheduleCB == 0)
+            scheduleCB = IEAddCallback(scheduler.notifyFd(), scheduleResultHelper, this);
+    }
+    else
+        DEBUGF(INDI::Logger::DBG_WARNING, "Scheduled commands unavailable: %s", err);
+
+    // Status is polled on the client's own thread, so a poll sitting out its
+    // timeout never holds up the event loop, and with it an Abort
+    lastPollSend = 0;
+    reportedPollError = SITECH_OK;
+    mount.startStatusStream(POLLMS, SiTechStatusCallback());
+    if (statusCB == 0)
+        statusCB = IEAddCallback(mount.statusFd(), statusHelper, this);
+
     SetParked(IsParked);
     SetTimer(POLLMS);
 
@@ -321,49 +549,151 @@ bool ScopeSiTech::Handshake()
 }
 char * ScopeSiTech::GetStringFromSerial(char * Send)
 {
-    int rc=0, nbytes_written=0, nbytes_read=0;
-    memset(SendBuf,'\0',MAXSOCKETBUFLEN);
     memset(RcvBuf,'\0',MAXSOCKETBUFLEN);
-    strncpy(SendBuf, Send, MAXSOCKETBUFLEN);
-    strncat(SendBuf,"\r\n",MAXSOCKETBUFLEN);
-//    DEBUGF(INDI::Logger::DBG_DEBUG, "CMD: %s", SendBuf);
-//    sprintf(myLogStg,"GSFS SendStrg=[%s]",SendBuf);DansLog((char*)myLogStg);
-//TTY_OK=0, TTY_READ_ERROR=-1, TTY_WRITE_ERROR=-2, TTY_SELECT_ERROR=-3, TTY_TIME_OUT=-4,
-//TTY_PORT_FAILURE=-5, TTY_PARAM_ERROR=-6, TTY_ERRNO = -7};
-//    int rcr = tty_read(PortFD, RcvBuf, 1, 0, &nbytes_read);//clear buff
-//    sprintf(myLogStg,"GSFS Pre-NormalRead nbytsrd=%d rcr=%d RcvStrg=[%s]",nbytes_read,rcr,RcvBuf);DansLog((char*)myLogStg);
-
-    if ( (rc = tty_write_string(PortFD, SendBuf, &nbytes_written)) != TTY_OK)
-    {
-        DEBUG(INDI::Logger::DBG_ERROR, "Error writing to the SiTechExe TCP server.");
+//    DEBUGF(INDI::Logger::DBG_DEBUG, "CMD: %s", Send);
+
+    // The lane comes from the command, so Abort and guide pulses go
+    // ahead of anything else waiting for the link
+    SiTechReply reply = mount.execute(SiTechLaneFor(Send), Send);
+    lastSendTime = reply.sendTime;
+    lastReceiveTime = reply.receiveTime;
+    if (reply.error != SITECH_OK)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Error talking to SiTechExe TCP server. Sent=%s (%s)", Send, SiTechLinkErrorString(reply.error));
         return NULL;
     }
-    int rcr = tty_read_section(PortFD, RcvBuf, '\n', SITECHTIMEOUT, &nbytes_read);
-//    if ( (rc == rcr) != TTY_OK)
-    if ( rcr != TTY_OK)
+    strncpy(RcvBuf, reply.text, MAXSOCKETBUFLEN - 1);
+
+//    DEBUGF(INDI::Logger::DBG_DEBUG, "RES: %s", RcvBuf);
+    return RcvBuf;
+}
+/* Pipelined GetStringFromSerial: all commands go out in one write and
+ * replies[i] answers commands[i].  One round trip for the lot.  Returns how
+ * many replies arrived; they come in order, so replies[0] up to that count
+ * are good even when a later one is missing. */
+int ScopeSiTech::GetStringsFromSerial(const char **commands, int count, char **replies)
+{
+    if (count > MAXBATCH) return 0;
+
+    SiTechReply batch[MAXBATCH];
+    int got = mount.executeBatch(SiTechLaneFor(commands, count), commands, count, batch);
+    lastSendTime = batch[0].sendTime;
+    lastReceiveTime = batch[0].receiveTime;
+    for (int i = 0; i < count; i++)
+    {
+        strncpy(BatchBuf[i], batch[i].text, MAXSOCKETBUFLEN - 1);
+        replies[i] = BatchBuf[i];
+    }
+    if (got < count)
+        DEBUGF(INDI::Logger::DBG_ERROR, "Error talking to SiTechExe TCP server. Sent=%s... (%d of %d replies, %s)",
+               commands[0], got, count, SiTechLinkErrorString(batch[got].error));
+    return got;
+}
+bool ScopeSiTech::setPriorityLink(bool enable)
+{
+    if (!enable)
     {
-//        sprintf(myLogStg,"GSFS ErrRead nbytsrd=%d rc=%drcr=%d RcvStrg=%s",nbytes_read,rc,rcr,RcvBuf);DansLog((char*)myLogStg);
-        char stsg[777];
-        sprintf(stsg, "Error readingg from SiTechExe TCP server. Sent=%s nByts=%d errNum=%d",SendBuf, nbytes_read, rcr);
-        DEBUG(INDI::Logger::DBG_ERROR, SendBuf);
+        transport.closePriorityLink();
+        return true;
+    }
 
-        return NULL;
+    char err[MAXRBUF];
+    int port = atoi(AddressT[1].text);
+    if (!transport.openPriorityLink(AddressT[0].text, port, err, sizeof(err)))
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Priority link not opened, Abort and guiding share the main connection: %s", err);
+        return false;
     }
-//    sprintf(myLogStg,"GSFS FirstNormalRead nbytsrd=%d rc=%drcr=%d RcvStrg=[%s]",nbytes_read,rc,rcr,RcvBuf);DansLog((char*)myLogStg);
-    if(nbytes_read > 0 && nbytes_read < 4)
+    DEBUGF(INDI::Logger::DBG_SESSION, "Priority link to %s:%d open for Abort and guiding.", AddressT[0].text, port);
+    return true;
+}
+void ScopeSiTech::updateLaneLatency()
+{
+    SiTechLaneStats safety  = transport.stats(LANE_SAFETY);
+    SiTechLaneStats guiding = transport.stats(LANE_GUIDING);
+    if (safety.count + guiding.count + abortCount == lastLaneCount) return;
+    lastLaneCount = safety.count + guiding.count + abortCount;
+
+    // Abort from when the request reached the driver, waiting for the link included
+    LaneLatencyN[0].value = abortLatency * 1000;
+    LaneLatencyN[1].value = abortMaxLatency * 1000;
+    LaneLatencyN[2].value = guiding.lastLatency * 1000;
+    LaneLatencyN[3].value = guiding.maxLatency * 1000;
+    LaneLatencyNP.s = (safety.failures + guiding.failures > 0) ? IPS_ALERT : IPS_OK;
+    IDSetNumber(&LaneLatencyNP, NULL);
+}
+/* Captures go to a new file in CAPTURE_DIR named after the device and the
+ * UTC start, never to a path a client chose. */
+void ScopeSiTech::startSessionCapture()
+{
+    char err[MAXRBUF] = "";
+    char path[MAXRBUF] = "";
+    const char *home = getenv("HOME");
+    bool started = false;
+    if (home == NULL || home[0] == '\0')
+        snprintf(err, sizeof(err), "HOME is not set");
+    else
     {
-        rcr = tty_read_section(PortFD, RcvBuf, '\n', SITECHTIMEOUT, &nbytes_read);
-        if ( rcr != TTY_OK)
+        char dir[MAXRBUF];
+        snprintf(dir, sizeof(dir), "%s/.indi", home);
+        mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%s/%s", home, CAPTURE_DIR);
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+            snprintf(err, sizeof(err), "%s: %s", dir, strerror(errno));
+        else
         {
-//            sprintf(myLogStg,"GSFS ErrRead2 nbytsrd=%d rc=%drcr=%d RcvStrg=[%s]",nbytes_read,rc,rcr,RcvBuf);DansLog((char*)myLogStg);
-            DEBUG(INDI::Logger::DBG_ERROR, "Error2 reading from SiTechExe TCP server.");
-            return NULL;
+            char device[MAXINDIDEVICE];
+            snprintf(device, sizeof(device), "%s", getDeviceName());
+            for (char *c = device; *c; c++)
+                if (!isalnum((unsigned char) *c) && *c != '-') *c = '_';
+            time_t now = time(NULL);
+            struct tm tm;
+            gmtime_r(&now, &tm);
+            char stamp[32];
+            strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+
+            // Two captures in the same second get a suffix rather than sharing a file
+            for (int i = 1; i < 10 && !started; i++)
+            {
+                if (i == 1) snprintf(path, sizeof(path), "%s/%s-%s.cap", dir, device, stamp);
+                else snprintf(path, sizeof(path), "%s/%s-%s-%d.cap", dir, device, stamp, i);
+                started = transport.startCapture(path, err, sizeof(err));
+                if (!started && errno != EEXIST) break;
+            }
         }
     }
-//    sprintf(myLogStg,"GSFS SecondNormalRead nbytsrd=%d rc=%drcr=%d RcvStrg=[%s]",nbytes_read,rc,rcr,RcvBuf);DansLog((char*)myLogStg);
 
-//    DEBUGF(INDI::Logger::DBG_DEBUG, "RES: %s", RcvBuf);
-    return RcvBuf;
+    if (started)
+    {
+        IUSaveText(&CaptureFileT[0], path);
+        CaptureSP.s = IPS_BUSY;
+        CaptureFileTP.s = IPS_BUSY;
+        DEBUGF(INDI::Logger::DBG_SESSION, "Capturing SiTechExe traffic to %s.", path);
+    }
+    else
+    {
+        IUResetSwitch(&CaptureSP);
+        CaptureS[1].s = ISS_ON;
+        CaptureSP.s = IPS_ALERT;
+        CaptureFileTP.s = IPS_IDLE;
+        DEBUGF(INDI::Logger::DBG_ERROR, "Capture not started: %s", err);
+    }
+    IDSetText(&CaptureFileTP, NULL);
+}
+/* Recording stops by itself when a write fails; say so once */
+void ScopeSiTech::checkSessionCapture()
+{
+    if (CaptureSP.s != IPS_BUSY || !transport.captureFailed()) return;
+
+    transport.stopCapture();
+    IUResetSwitch(&CaptureSP);
+    CaptureS[1].s = ISS_ON;
+    CaptureSP.s = IPS_ALERT;
+    IDSetSwitch(&CaptureSP, NULL);
+    CaptureFileTP.s = IPS_ALERT;
+    IDSetText(&CaptureFileTP, NULL);
+    DEBUGF(INDI::Logger::DBG_ERROR, "Capture to %s stopped: writing failed after %llu bytes.",
+           CaptureFileT[0].text, (unsigned long long) transport.capturedBytes());
 }
 static char MessageFromScope[1500];
 static char ErrorMessage[1500];
@@ -392,60 +722,50 @@ bool ScopeSiTech::SetUpVarsFromReturnString(char * ScopeAnswer, bool PrintBools)
     * Next is Dec (Hours)
     * Next is Altitude (degs)
     * Next is Azimuth (degs)
+    * Next is Secondary axisPositionDegsSecondary
     * Next is Primary axisPositionDegsPrimary
-    * Next is Primary axisPositionDegsSecondary
     * Next is Scope Sidereal Time (hours).
     * Next is Scope Julian Day.
     * Next is ScopeTime (hours)
     * Next is a possible string message.
 */
-    if(ScopeAnswer == NULL) return false;
-    int Len = strlen(ScopeAnswer);
-    if(Len < 3) return false;
-    int ScopeStt = atoi(ScopeAnswer);
-    IsInitialized = ((ScopeStt & 1) > 0);
-    IsTracking = ((ScopeStt & 2) > 0);
-    IsSlewing = ((ScopeStt & 4) > 0);
-    IsParking = ((ScopeStt & 8) > 0);
-    IsParked = ((ScopeStt & 16) > 0);
-    IsLookingEast = ((ScopeStt & 32) > 0);
-    IsInBlinky = ((ScopeStt & 64) > 0);
-    IsCommunicatingWithController = ((ScopeStt & 128) == 0);
+    SiTechStatus status;
+    if (!SiTechParseStatus(ScopeAnswer, &status)) return false;
+    int ScopeStt = status.bits;
+    scopeStatusBits = ScopeStt;
+    IsInitialized = status.isInitialized();
+    IsTracking = status.isTracking();
+    IsSlewing = status.isSlewing();
+    IsParking = status.isParking();
+    IsParked = status.isParked();
+    scheduler.setHold(IsParked || IsParking);
+    IsLookingEast = status.isLookingEast();
+    IsInBlinky = status.isInBlinky();
+    IsCommunicatingWithController = status.isCommunicating();
 
     if(PrintBools && LastScopeStt != ScopeStt)
     {
-        sprintf(myLogStg,"ScopeStt=%d IsInit=%d IsTrack=%d IsSlew=%d IsParking=%d IsParked=%d IsLookingEast=%d IsInBlinky=%d IsComm=%d",
+        DEBUGF(INDI::Logger::DBG_DEBUG, "ScopeStt=%d IsInit=%d IsTrack=%d IsSlew=%d IsParking=%d IsParked=%d IsLookingEast=%d IsInBlinky=%d IsComm=%d",
             ScopeStt, IsInitialized, IsTracking, IsSlewing, IsParking, IsParked, IsLookingEast, IsInBlinky, IsCommunicatingWithController );
-        DansLog((char*)myLogStg);
-    }
-    char * ptr = ScopeAnswer;
-    int NextSemColonLoc=0;
-    while(NextSemColonLoc < Len)
-    {
-       if(ScopeAnswer[NextSemColonLoc] == ';') break;
-       NextSemColonLoc++;
-    }
-    ptr = ScopeAnswer + NextSemColonLoc;
-    Len --; if (Len < 1) Len = 1;
-    size_t offset = 0;
-    long p_sa = (long) (ptr - ScopeAnswer);
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld scpanwr=%s",NextSemColonLoc,Len,p_sa,ptr);DansLog((char*)myLogStg);
-    p_sa = (long) (ptr - ScopeAnswer);
-    if(ptr - ScopeAnswer < Len) currentRA = stod(ptr + 1, &offset); ptr += offset + 1;
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld ra=%f scpanwr=%s",NextSemColonLoc,Len,p_sa,currentRA,ptr);DansLog((char*)myLogStg);
-    if(ptr - ScopeAnswer < Len) currentDEC = stod(ptr + 1, &offset); ptr += offset + 1;
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld de=%f scpanwr=%s",NextSemColonLoc,Len,p_sa,currentDEC,ptr);DansLog((char*)myLogStg);
-    if(ptr - ScopeAnswer < Len) currentAlt = stod(ptr+1, &offset); ptr += offset + 1;
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld al=%f scpanwr=%s",NextSemColonLoc,Len,p_sa,currentAlt,ptr);DansLog((char*)myLogStg);
-    if(ptr - ScopeAnswer < Len) currentAz = stod(ptr+1, &offset); ptr += offset + 1;
-    if(ptr - ScopeAnswer < Len) axisPositionDegsPrimary = stod(ptr+1, &offset); ptr += offset + 1;
-    if(ptr - ScopeAnswer < Len) axisPositionDegsSecondary = stod(ptr+1, &offset); ptr += offset + 1;
-    if(ptr - ScopeAnswer < Len) scopeSiderealTime = stod(ptr+1, &offset); ptr += offset + 1;
-    if(ptr - ScopeAnswer < Len) scopeJulianDay = stod(ptr+1, &offset); ptr += offset + 1;
-    if(ptr - ScopeAnswer < Len) scopeTime = stod(ptr+1,  &offset); ptr += offset + 1;
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld ScpTm=%f scpanwr=%s",NextSemColonLoc,Len,p_sa,scopeTime,ptr);DansLog((char*)myLogStg);
-    if(strlen(ptr) > 3)strncpy(MessageFromScope,ptr,499);
-//    sprintf(myLogStg,"SetErrFrmRetStg NextSemColonLoc=%d Len=%d p-sa=%ld ScpTm=%f Mess=%s",NextSemColonLoc,Len,p_sa,scopeTime,MessageFromScope);DansLog((char*)myLogStg);
+    }
+    // A short reply leaves the fields it does not carry as they were
+    if (status.fields > 1) currentRA = status.ra;
+    if (status.fields > 2) currentDEC = status.dec;
+    if (status.fields > 3) currentAlt = status.alt;
+    if (status.fields > 4) currentAz = status.az;
+    if (status.fields > 5) axisPositionDegsSecondary = status.axisSecondary;
+    if (status.fields > 6) axisPositionDegsPrimary = status.axisPrimary;
+    if (status.fields > 7) scopeSiderealTime = status.siderealTime;
+    if (status.fields > 8) scopeJulianDay = status.julianDay;
+    if (status.fields > 9) scopeTime = status.scopeTime;
+    if (strlen(status.message) > 2) strncpy(MessageFromScope, status.message, sizeof(MessageFromScope) - 1);
+    if (scopeJulianDay > 0)
+    {
+        sampleTime = mountClock.addSample(lastSendTime, lastReceiveTime, SiTechMountTime(scopeJulianDay, scopeTime));
+        if (scheduler.isRunning()) scheduler.setClock(mountClock);
+    }
+    else
+        sampleTime = lastSendTime + (lastReceiveTime - lastSendTime) / 2;
   //enum TelescopeStatus { SCOPE_IDLE, SCOPE_SLEWING, SCOPE_TRACKING, SCOPE_PARKING, SCOPE_PARKED };
     if (IsParking) TrackState = SCOPE_PARKING;
     else if (IsParked) TrackState = SCOPE_PARKED;
@@ -455,75 +775,281 @@ bool ScopeSiTech::SetUpVarsFromReturnString(char * ScopeAnswer, bool PrintBools)
 
     if(PrintBools && LastScopeStt != ScopeStt)
     {
-        sprintf(myLogStg,"TrackState=%d", TrackState );
-        DansLog((char*)myLogStg);
+        DEBUGF(INDI::Logger::DBG_DEBUG, "TrackState=%d", TrackState);
     }
     LastScopeStt = ScopeStt;
+    publishStatusSegment();
     return true;
 }
-/*
-bool ScopeSiTech::Disconnect()
+void ScopeSiTech::publishStatusSegment()
 {
+    if (!statusSegment.isOpen()) return;
+
+    SiTechShmFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.sampleTimeNs  = (uint64_t) (sampleTime * 1e9);
+    frame.roundTripUs   = (uint32_t) ((lastReceiveTime - lastSendTime) * 1e6);
+    frame.statusBits    = (uint32_t) scopeStatusBits;
+    frame.ra            = currentRA;
+    frame.dec           = currentDEC;
+    frame.alt           = currentAlt;
+    frame.az            = currentAz;
+    frame.axisPrimary   = axisPositionDegsPrimary;
+    frame.axisSecondary = axisPositionDegsSecondary;
+    frame.siderealTime  = scopeSiderealTime;
+    frame.julianDay     = scopeJulianDay;
+    frame.scopeTime     = scopeTime;
+    statusSegment.publish(frame);
+}
+bool ScopeSiTech::readSiteLocation(const char * reply)
+{
+    // Reply is "latitude;longitude;elevation;_SiteLocations"
+    double lat, lng, elev;
+    if (!SiTechParseSiteLocation(reply, &lat, &lng, &elev))
+        return false;
 
-    DEBUG(INDI::Logger::DBG_SESSION, "Telescope SiTech is offline.");
+    scopeSiteLatitude = lat;
+    haveScopeSiteLocation = true;
+    DEBUGF(INDI::Logger::DBG_DEBUG, "SiTechExe site: lat %g long %g elev %g", lat, lng, elev);
+    return true;
 }
-*/
-static bool inReadScopeStatus = false;
-bool ScopeSiTech::ReadScopeStatus()
+double ScopeSiTech::siteLatitude()
 {
-    if(inReadScopeStatus) return false;
-    inReadScopeStatus = true;
-    SetUpVarsFromReturnString(GetStringFromSerial((char *)"ReadScopeStatus"), true);
+    return haveScopeSiteLocation ? scopeSiteLatitude : LocationN[LOCATION_LATITUDE].value;
+}
+void ScopeSiTech::updateClockSync()
+{
+    // Once a second is plenty for a clock estimate
+    if (!mountClock.isValid() || sampleTime - lastClockReport < 1.0) return;
+    lastClockReport = sampleTime;
+
+    ClockSyncN[0].value = mountClock.offsetAt(sampleTime) * 1000;
+    ClockSyncN[1].value = mountClock.drift() * 1e6;
+    ClockSyncN[2].value = mountClock.lastRoundTrip() * 1000;
+    ClockSyncN[3].value = mountClock.minRoundTrip() * 1000;
+    ClockSyncNP.s = IPS_OK;
+    IDSetNumber(&ClockSyncNP, NULL);
+}
+bool ScopeSiTech::readScopeDestination(const char * reply, double ra, double dec)
+{
+    // Same layout as the status reply, but the axis angle, sidereal time and
+    // Julian day fields hold the destination RA, Dec, Alt and Az
+    double fields[11];
+    if (reply == NULL || SiTechParseFields(reply, fields, 11) < 9)
+    {
+        DEBUG(INDI::Logger::DBG_WARNING, "Cannot read the slew destination from SiTechExe.");
+        SlewDestinationNP.s = IPS_ALERT;
+        IDSetNumber(&SlewDestinationNP, NULL);
+        return false;
+    }
 
-    static struct timeval ltv;
-    struct timeval tv;
-    double dt=0, da_ra=0, da_dec=0, dx=0, dy=0, ra_guide_dt=0, dec_guide_dt=0;
-    static double last_dx=0, last_dy=0;
-    int nlocked, ns_guide_dir=-1, we_guide_dir=-1;
-    char RA_DISP[64], DEC_DISP[64], RA_GUIDE[64], DEC_GUIDE[64], RA_PE[64], DEC_PE[64], RA_TARGET[64], DEC_TARGET[64];
+    SlewDestinationN[0].value = fields[5];
+    SlewDestinationN[1].value = fields[6];
+    SlewDestinationN[2].value = fields[7];
+    SlewDestinationN[3].value = fields[8];
+    SlewDestinationN[4].value = slewEstimate;
 
-    if (IsTracking)
+    // If SiTechExe refused the GoTo it still reports the old destination
+    if (SiTechSlewHistory::distance(fields[5], fields[6], ra, dec) > 0.5)
     {
-        IUResetSwitch(&TrackModeSP);
-        TrackModeSP.s = IPS_OK;
+        DEBUG(INDI::Logger::DBG_WARNING, "SiTechExe destination does not match the GoTo target, GoTo was probably rejected.");
+        SlewDestinationN[4].value = 0;
+        SlewDestinationNP.s = IPS_ALERT;
+        IDSetNumber(&SlewDestinationNP, NULL);
+        return false;
     }
-    else
+
+    DEBUGF(INDI::Logger::DBG_DEBUG, "Slew destination alt %.2f az %.2f, expected to take %.1f s", fields[7], fields[8], slewEstimate);
+    SlewDestinationNP.s = IPS_BUSY;
+    IDSetNumber(&SlewDestinationNP, NULL);
+    return true;
+}
+void ScopeSiTech::updateSlewTiming()
+{
+    if (!slewTimed) return;
+
+    double elapsed = sampleTime - slewStartTime;
+    if (IsSlewing)
     {
-        IUResetSwitch(&TrackModeSP);
-        TrackModeSP.s = IPS_IDLE;
+        slewSeen = true;
+        double left = slewEstimate - elapsed;
+        if (left < 0) left = 0;
+        if (fabs(left - SlewDestinationN[4].value) >= 1)
+        {
+            SlewDestinationN[4].value = left;
+            IDSetNumber(&SlewDestinationNP, NULL);
+        }
+        return;
+    }
+
+    // Slewing bit not raised yet; SiTechExe answers before the mount starts
+    if (!slewSeen && elapsed < SLEW_START_WAIT) return;
+
+    if (slewSeen)
+    {
+        slewHistory.record(slewDistance, elapsed);
+        DEBUGF(INDI::Logger::DBG_DEBUG, "Slew of %.1f degrees took %.1f s (estimated %.1f s)", slewDistance, elapsed, slewEstimate);
+    }
+    slewTimed = false;
+    SlewDestinationN[4].value = 0;
+    SlewDestinationNP.s = IPS_OK;
+    IDSetNumber(&SlewDestinationNP, NULL);
+}
+double ScopeSiTech::expectedTrackRate()
+{
+    switch (currentTrackMode)
+    {
+        case TRACK_SOLAR:  return TRACKRATE_SOLAR;
+        case TRACK_LUNAR:  return TRACKRATE_LUNAR;
+        case TRACK_CUSTOM: return fabs(TrackRateN[RA_AXIS].value);
+        default:           return TRACKRATE_SIDEREAL;     // also tracking started outside INDI
+    }
+}
+void ScopeSiTech::updateTrackingAnalysis()
+{
+    bool steady = IsTracking && !IsSlewing && !IsParking && !IsParked && !IsInBlinky;
+    if (!steady || currentTrackMode != analysedTrackMode)
+    {
+        if (analysedAxis != -1 || trackingAnalyzer.fill() > 0)
+        {
+            trackingAnalyzer.reset();
+            TrackingErrorNP.s = IPS_IDLE;
+            IDSetNumber(&TrackingErrorNP, NULL);
+        }
+        analysedTrackMode = currentTrackMode;
+        analysedAxis = -1;
+        analysedTimeStart = 0;
+        if (!steady) return;
     }
-    /* update elapsed time since last poll, don't presume exactly POLLMS */
-    gettimeofday (&tv, NULL);
 
-    if (ltv.tv_sec == 0 && ltv.tv_usec == 0)
-        ltv = tv;
+    double rate = expectedTrackRate();
+    double axes[2] = { axisPositionDegsPrimary, axisPositionDegsSecondary };
 
-    dt = tv.tv_sec - ltv.tv_sec + (tv.tv_usec - ltv.tv_usec)/1e6;
-    ltv = tv;
+    // Work out which reported axis is the one tracking at the sidereal-ish rate
+    if (analysedAxis == -1)
+    {
+        if (analysedTimeStart == 0)
+        {
+            analysedTimeStart = sampleTime;
+            analysedAxisStart[0] = axes[0];
+            analysedAxisStart[1] = axes[1];
+            return;
+        }
+        double dt = sampleTime - analysedTimeStart;
+        if (dt < 2) return;
+        double r0 = fabs(axes[0] - analysedAxisStart[0]) * 3600 / dt;
+        double r1 = fabs(axes[1] - analysedAxisStart[1]) * 3600 / dt;
+        analysedAxis = (fabs(r0 - rate) <= fabs(r1 - rate)) ? 0 : 1;
+        DEBUGF(INDI::Logger::DBG_DEBUG, "Tracking error analysis on the %s axis (%.3f \"/s, expected %.3f)",
+               analysedAxis == 0 ? "primary" : "secondary", analysedAxis == 0 ? r0 : r1, rate);
+    }
 
-    fs_sexa(RA_DISP, fabs(dx), 2, 3600 );
-    fs_sexa(DEC_DISP, fabs(dy), 2, 3600 );
+    trackingAnalyzer.addSample(sampleTime, axes[analysedAxis], rate);
 
-    fs_sexa(RA_GUIDE, fabs(ra_guide_dt), 2, 3600 );
-    fs_sexa(DEC_GUIDE, fabs(dec_guide_dt), 2, 3600 );
+    if (sampleTime - lastPEReport < PE_REPORT_SECONDS) return;
+    lastPEReport = sampleTime;
 
-    fs_sexa(RA_TARGET, targetRA, 2, 3600);
-    fs_sexa(DEC_TARGET, targetDEC, 2, 3600);
+    TrackingErrorN[0].value = trackingAnalyzer.rateError();
+    TrackingErrorN[1].value = trackingAnalyzer.periodicRms();
+    TrackingErrorN[2].value = trackingAnalyzer.fill() * 100;
+    TrackingErrorNP.s = trackingAnalyzer.isReady() ? IPS_OK : IPS_BUSY;
+    IDSetNumber(&TrackingErrorNP, NULL);
 
+    if (!trackingAnalyzer.isReady()) return;
+
+    SiTechPEPeak peaks[PE_PEAKS];
+    int n = trackingAnalyzer.peaks(peaks, PE_PEAKS);
+    for (int i = 0; i < PE_PEAKS; i++)
+    {
+        PESpectrumN[i * 2].value     = (i < n) ? peaks[i].period : 0;
+        PESpectrumN[i * 2 + 1].value = (i < n) ? peaks[i].amplitude : 0;
+    }
+    PESpectrumNP.s = IPS_OK;
+    IDSetNumber(&PESpectrumNP, NULL);
+}
+void ScopeSiTech::updateLimitTimes()
+{
+    double toLimit = -1, toFlip = -1;
 
-    if ((dx!=last_dx || dy!=last_dy || ra_guide_dt || dec_guide_dt))
+    if (IsTracking && !IsSlewing && !IsParked)
     {
-        last_dx=dx;
-        last_dy=dy;
-        //DEBUGF(INDI::Logger::DBG_DEBUG, "dt is %g\n", dt);
-        DEBUGF(INDI::Logger::DBG_DEBUG, "RA Guide Correction (%g) %s -- Direction %s", ra_guide_dt, RA_GUIDE, ra_guide_dt > 0 ? "East" : "West");
-        DEBUGF(INDI::Logger::DBG_DEBUG, "DEC Guide Correction (%g) %s -- Direction %s", dec_guide_dt, DEC_GUIDE, dec_guide_dt > 0 ? "North" : "South");
+        double ha = scopeSiderealTime - currentRA;
+        if (horizonMask.isLoaded())
+            toLimit = SiTechTimeUntilBelowMask(horizonMask, ha, currentDEC, siteLatitude(), LIMIT_SEARCH_HOURS);
+        toFlip = SiTechTimeUntilFlip(ha, FlipLimitN[0].value / 15.0, IsLookingEast);
     }
+    if (toLimit > 0) toLimit *= 60;
+    if (toFlip > 0) toFlip *= 60;
+
+    // Only tell clients when it moved by a tenth of a minute
+    if (fabs(toLimit - LimitTimesN[0].value) < 0.1 && fabs(toFlip - LimitTimesN[1].value) < 0.1)
+        return;
+
+    LimitTimesN[0].value = toLimit;
+    LimitTimesN[1].value = toFlip;
+    if (toLimit == 0 || toFlip == 0)
+        LimitTimesNP.s = IPS_ALERT;
+    else if ((toLimit > 0 && toLimit < 10) || (toFlip > 0 && toFlip < 10))
+        LimitTimesNP.s = IPS_BUSY;
+    else
+        LimitTimesNP.s = IPS_OK;
+    IDSetNumber(&LimitTimesNP, NULL);
+}
+bool ScopeSiTech::Disconnect()
+{
+    // Readers must not mistake the last frame for a live mount
+    statusSegment.close();
+    if (statusCB > 0) IERmCallback(statusCB);
+    statusCB = 0;
+    cancelSchedule("disconnect");
+    mount.disconnect();
+
+    DEBUG(INDI::Logger::DBG_SESSION, "Telescope SiTech is offline.");
+    return INDI::Telescope::Disconnect();
+}
+static bool inReadScopeStatus = false;
+bool ScopeSiTech::ReadScopeStatus()
+{
+    if(inReadScopeStatus) return false;
 
-//    if (ns_guide_dir != -1 || we_guide_dir != -1)
-  //      IDSetNumber(&EqPENV, NULL);
+    checkSessionCapture();
 
+    // The client polls on its own thread; here we only take the newest frame
+    int pollError = mount.streamError();
+    if (pollError != reportedPollError)
+    {
+        if (pollError != SITECH_OK)
+            DEBUGF(INDI::Logger::DBG_ERROR, "Error talking to SiTechExe TCP server. Sent=ReadScopeStatus (%s)", SiTechLinkErrorString(pollError));
+        reportedPollError = pollError;
+    }
+    SiTechReply reply;
+    if (!mount.latestStatus(&reply) || reply.sendTime <= lastPollSend)
+        return pollError == SITECH_OK;
+    lastPollSend = reply.sendTime;
+    // A command answered after this poll went out already gave us a newer state
+    if (reply.sendTime < lastSendTime)
+        return true;
+
+    inReadScopeStatus = true;
+    strncpy(RcvBuf, reply.text, MAXSOCKETBUFLEN - 1);
+    lastSendTime = reply.sendTime;
+    lastReceiveTime = reply.receiveTime;
+    SetUpVarsFromReturnString(RcvBuf, true);
 
+    if (pendingSettings.isPending(SETTING_TRACK))
+    {
+        // Leave the requested mode showing until it is sent
+    }
+    else if (IsTracking)
+    {
+        IUResetSwitch(&TrackModeSP);
+        TrackModeSP.s = IPS_OK;
+    }
+    else
+    {
+        IUResetSwitch(&TrackModeSP);
+        TrackModeSP.s = IPS_IDLE;
+    }
     char RAStr[64], DecStr[64];
 
     fs_sexa(RAStr, currentRA, 2, 3600);
@@ -532,6 +1058,12 @@ bool ScopeSiTech::ReadScopeStatus()
     DEBUGF(DBG_SCOPE, "Current RA: %s Current DEC: %s", RAStr, DecStr);
 
     NewRaDec(currentRA, currentDEC);
+    updateSlewTiming();
+    updateLimitTimes();
+    updateClockSync();
+    updateLaneLatency();
+    updateTrackingAnalysis();
+    updateCentering();
     inReadScopeStatus = false;
     return true;
 }
@@ -551,23 +1083,63 @@ bool ScopeSiTech::Goto(double r,double d)
     fs_sexa(RAStr, targetRA, 2, 3600);
     fs_sexa(DecStr, targetDEC, 2, 3600);
 
-   ln_equ_posn lnradec;
-   lnradec.ra = (currentRA * 360) / 24.0;
-   lnradec.dec =currentDEC;
-
+   // Refuse targets behind the horizon mask without asking the mount
+   double ha = scopeSiderealTime - r;
+   double alt, az;
+   SiTechEquToHorizontal(ha, d, siteLatitude(), &alt, &az);
+   if (horizonMask.isLoaded() && !horizonMask.isAbove(alt, az))
+   {
+       DEBUGF(INDI::Logger::DBG_ERROR, "Target RA: %s - DEC: %s is below the horizon mask (alt %.1f, limit %.1f at az %.1f).",
+              RAStr, DecStr, alt, horizonMask.limitAt(az), az);
+       return false;
+   }
+   DEBUGF(INDI::Logger::DBG_DEBUG, "Target alt %.2f az %.2f, predicted pier side: looking %s",
+          alt, az, SiTechPredictLookingEast(ha) ? "east" : "west");
+
+   double distance = SiTechSlewHistory::distance(currentRA, currentDEC, r, d);
+
+   // GoTo and ReadScopeDestination in one round trip
    char sStr[128];
-   sprintf(sStr,"GoTo %f %f",r,d);
-   SetUpVarsFromReturnString(GetStringFromSerial((char *)sStr), true);
-
-   EqNP.s    = IPS_BUSY;
+   SiTechEncodeGoTo(sStr, sizeof(sStr), r, d);
+   const char *cmds[2] = { sStr, "ReadScopeDestination" };
+   char *replies[2];
+   MessageFromScope[0] = '\0';         // a short reply must not leave the last command's message behind
+   int got = GetStringsFromSerial(cmds, 2, replies);
+   if (got < 1)
+       return false;
+   SetUpVarsFromReturnString(replies[0], true);
+   if(strstr(MessageFromScope,"GoTo") == NULL)
+   {
+       sprintf(ErrorMessage, "GoTo is rejected. Reason=%s",MessageFromScope);
+       DEBUG(INDI::Logger::DBG_ERROR,ErrorMessage);
+       return false;
+   }
+
+   beginSlew(r, d, distance, got > 1 ? replies[1] : NULL);
 
    DEBUGF(INDI::Logger::DBG_SESSION,"Slewing to RA: %s - DEC: %s", RAStr, DecStr);
    return true;
 }
+/* A GoTo was accepted: time it, and tell the dome where we are going right
+ * away instead of letting it chase us.  destination is the ReadScopeDestination
+ * reply, if there is one. */
+void ScopeSiTech::beginSlew(double ra, double dec, double distance, const char *destination)
+{
+    targetRA  = ra;
+    targetDEC = dec;
+    EqNP.s    = IPS_BUSY;
+    IDSetNumber(&EqNP, NULL);
+
+    slewStartTime = sampleTime;
+    slewDistance  = distance;
+    slewEstimate  = slewHistory.estimate(distance);
+    slewSeen      = false;
+    slewTimed     = destination != NULL && readScopeDestination(destination, ra, dec);
+}
 bool ScopeSiTech::Sync(double ra, double dec)
 {
 char cStr[1164];
-    sprintf(cStr,"Sync %f %f 0",ra,dec);//the zero is call up the sitech init window.  1 = offset instantaneous, 2 = load calibration instantaneos
+    SiTechEncodeSync(cStr, sizeof(cStr), ra, dec, 0);//the zero is call up the sitech init window.  1 = offset instantaneous, 2 = load calibration instantaneos
     SetUpVarsFromReturnString(GetStringFromSerial((char *)cStr), true);
     if(strstr(MessageFromScope,"Accepted") == NULL)
     {
@@ -584,7 +1156,11 @@ char cStr[1164];
 
 bool ScopeSiTech::Park()
 {
-    SetUpVarsFromReturnString(GetStringFromSerial((char *)"Park 0"), true);//the zero is regular park, could do 1 or 2 as well.
+    cancelSchedule("Park");
+
+    char pStr[32];
+    SiTechEncodePark(pStr, sizeof(pStr), 0);//the zero is regular park, could do 1 or 2 as well.
+    SetUpVarsFromReturnString(GetStringFromSerial(pStr), true);
     if(strstr(MessageFromScope,"Park") == NULL)
     {
         sprintf(ErrorMessage, "Park is rejected. Reason=%s",MessageFromScope);
@@ -596,6 +1172,15 @@ bool ScopeSiTech::Park()
     return true;
 }
 
+/* Take the state from a status reply that rode along in a batch, keeping
+ * the message of the command it followed. */
+void ScopeSiTech::refreshStatusFrom(char * reply)
+{
+    char saved[sizeof(MessageFromScope)];
+    memcpy(saved, MessageFromScope, sizeof(saved));
+    SetUpVarsFromReturnString(reply, false);
+    memcpy(MessageFromScope, saved, sizeof(saved));
+}
 bool ScopeSiTech::UnPark()
 {
     if (INDI::Telescope::isLocked())
@@ -609,7 +1194,13 @@ bool ScopeSiTech::UnPark()
         return false;
     }
 
-    SetUpVarsFromReturnString(GetStringFromSerial((char *)"UnPark"), true);
+    const char *cmds[2] = { "UnPark", "ReadScopeStatus" };
+    char *replies[2];
+    int got = GetStringsFromSerial(cmds, 2, replies);
+    if (got < 1)
+        return false;
+    SetUpVarsFromReturnString(replies[0], true);
+    if (got > 1) refreshStatusFrom(replies[1]);
     if(strstr(MessageFromScope,"UnPark") == NULL)
     {
         sprintf(ErrorMessage, "UnPark is rejected. Reason=%s",MessageFromScope);
@@ -623,18 +1214,116 @@ bool ScopeSiTech::UnPark()
 }
 bool ScopeSiTech::setSiTechTracking(bool enable, bool isSidereal, double raRate, double deRate)
 {
-    int on      = enable ? 1 : 0;
-    int ignore  = isSidereal ? 1 : 0;
-
     char pCMD[MAXRBUF];
 
-    snprintf(pCMD,MAXRBUF, "SetTrackMode %d %d %f %f", on, ignore, raRate, deRate);
-    SetUpVarsFromReturnString(GetStringFromSerial((char *)pCMD), true);
+    SiTechEncodeSetTrackMode(pCMD, MAXRBUF, enable, !isSidereal, raRate, deRate);
+
+    // Refresh the status in the same round trip so the tracking state we report is current
+    const char *cmds[2] = { pCMD, "ReadScopeStatus" };
+    char *replies[2];
+    int got = GetStringsFromSerial(cmds, 2, replies);
+    if (got < 1)
+        return false;
+    SetUpVarsFromReturnString(replies[0], true);
+    if (got > 1) refreshStatusFrom(replies[1]);
 
     if(strstr(MessageFromScope, "SetTrackMode") == NULL) return false;
     return true;
 }
 
+/* Setting changes from clients go through pendingSettings: only the latest
+ * value of each is acted on, once the link is free. */
+void ScopeSiTech::postSetting(SiTechSetting slot, const double *values, int count, const char *label)
+{
+    double previous[SETTING_MAX_VALUES];
+    if (pendingSettings.post(slot, values, count, previous))
+        DEBUGF(INDI::Logger::DBG_DEBUG, "%s %g %g %g superseded before it was sent.", label, previous[0], previous[1], previous[2]);
+    if (settingsTimerID == 0)
+        settingsTimerID = IEAddTimer(SETTINGS_COALESCE_MS, settingsFlushHelper, this);
+}
+void ScopeSiTech::settingsFlushHelper(void *p)
+{
+    ScopeSiTech *scope = static_cast<ScopeSiTech *>(p);
+    scope->settingsTimerID = 0;
+    scope->flushSettings();
+}
+void ScopeSiTech::flushSettings()
+{
+    double v[SETTING_MAX_VALUES];
+    unsigned superseded = 0;
+
+    // Guide and slew rates are kept by the driver, only the answer was held back
+    if (pendingSettings.take(SETTING_GUIDE_RATE, v, &superseded))
+    {
+        GuideRateNP.s = IPS_OK;
+        if (superseded)
+            IDSetNumber(&GuideRateNP, "%u earlier guide rate changes superseded.", superseded);
+        else
+            IDSetNumber(&GuideRateNP, NULL);
+    }
+    if (pendingSettings.take(SETTING_SLEW_RATE, v, &superseded))
+    {
+        SlewRateSP.s = IPS_OK;
+        if (superseded)
+            IDSetSwitch(&SlewRateSP, "%u earlier slew rate changes superseded.", superseded);
+        else
+            IDSetSwitch(&SlewRateSP, NULL);
+    }
+
+    if (!pendingSettings.isPending(SETTING_TRACK)) return;
+
+    // Status polls and anything more urgent have the link first
+    if (!transport.isIdle(LANE_CONTROL))
+    {
+        settingsTimerID = IEAddTimer(SETTINGS_COALESCE_MS, settingsFlushHelper, this);
+        return;
+    }
+    pendingSettings.take(SETTING_TRACK, v, &superseded);
+    applyTrackSetting((int) v[0], v[1], v[2], superseded);
+}
+void ScopeSiTech::applyTrackSetting(int mode, double raRate, double deRate, unsigned superseded)
+{
+    bool enable     = (mode != -1);
+    bool isSidereal = (mode == TRACK_SIDEREAL);
+    double dRA=0, dDE=0;
+    if (mode == TRACK_SOLAR)
+        dRA = TRACKRATE_SOLAR;
+    else if (mode == TRACK_LUNAR)
+        dRA = TRACKRATE_LUNAR;
+    else if (mode == TRACK_CUSTOM)
+    {
+        dRA = raRate;
+        dDE = deRate;
+    }
+
+    bool ok = setSiTechTracking(enable, isSidereal, dRA, dDE);
+    if (ok)
+    {
+        currentTrackMode = mode;
+        sprintf(ErrorMessage, "SetTrackMode OK. Mess=%s",MessageFromScope);
+    }
+    else
+        sprintf(ErrorMessage, "SetTrackMode is rejected. Reason=%s",MessageFromScope);
+    DEBUG(INDI::Logger::DBG_SESSION, ErrorMessage);
+    if (superseded)
+        DEBUGF(INDI::Logger::DBG_SESSION, "%u earlier track changes superseded.", superseded);
+
+    // A newer request keeps the properties busy until it is sent
+    if (pendingSettings.isPending(SETTING_TRACK)) return;
+
+    requestedTrackMode = currentTrackMode;
+    IUResetSwitch(&TrackModeSP);
+    if (currentTrackMode != -1) TrackModeS[currentTrackMode].s = ISS_ON;
+    TrackModeSP.s = !ok ? IPS_ALERT : (IsTracking ? IPS_OK : IPS_IDLE);
+    IDSetSwitch(&TrackModeSP, NULL);
+
+    if (TrackRateNP.s == IPS_BUSY)
+    {
+        TrackRateNP.s = ok ? IPS_OK : IPS_ALERT;
+        IDSetNumber(&TrackRateNP, NULL);
+    }
+}
+
 bool ScopeSiTech::ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n)
 {
     //  first check if it's for our device
@@ -645,37 +1334,71 @@ bool ScopeSiTech::ISNewNumber (const char *dev, const char *name, double values[
         if (!strcmp(name, TrackRateNP.name))
         {
             IUUpdateNumber(&TrackRateNP, values, names, n);
-            if (currentTrackMode != TRACK_CUSTOM)
+            if (requestedTrackMode != TRACK_CUSTOM)
             {
                 DEBUG(INDI::Logger::DBG_ERROR, "Can only set tracking rate if track mode is custom.");
                 TrackRateNP.s = IPS_ALERT;
             }
             else
             {
-                setSiTechTracking(true, false, TrackRateN[RA_AXIS].value, TrackRateN[DEC_AXIS].value);
-                if(strstr(MessageFromScope,"SetTrackMode") == NULL)
-                {
-                    sprintf(ErrorMessage, "SetTrackMode is rejected. Reason=%s",MessageFromScope);
-                    DEBUG(INDI::Logger::DBG_SESSION,ErrorMessage);
-                    TrackRateNP.s = IPS_ALERT;
-                }
-                else
-                {
-                    TrackRateNP.s = IPS_OK;
-                    sprintf(ErrorMessage, "SetTrackMode OK. Mess=%s",MessageFromScope);
-                    DEBUG(INDI::Logger::DBG_SESSION, ErrorMessage);
-                }
+                double setting[3] = { TRACK_CUSTOM, TrackRateN[RA_AXIS].value, TrackRateN[DEC_AXIS].value };
+                postSetting(SETTING_TRACK, setting, 3, "Track rates");
+                TrackRateNP.s = IPS_BUSY;
             }
 
             IDSetNumber(&TrackRateNP, NULL);
             return true;
         }
 
+         // A measured offset; starts a centering run when none is going
+         if (!strcmp(name, CenterOffsetNP.name))
+         {
+             if (centerer.state() == CENTER_MOVING)
+             {
+                 CenterOffsetNP.s = IPS_ALERT;
+                 IDSetNumber(&CenterOffsetNP, "A correction is still in progress, offset ignored.");
+                 return true;
+             }
+             IUUpdateNumber(&CenterOffsetNP, values, names, n);
+             if (!centerer.isActive())
+             {
+                 startCentering();
+                 if (!centerer.isActive()) return true;
+             }
+             centerMeasured(CenterOffsetN[0].value, CenterOffsetN[1].value);
+             return true;
+         }
+
+         if (!strcmp(name, CenterSettingsNP.name))
+         {
+             IUUpdateNumber(&CenterSettingsNP, values, names, n);
+             CenterSettingsNP.s = IPS_OK;
+             IDSetNumber(&CenterSettingsNP, NULL);
+             return true;
+         }
+
+         if (!strcmp(name, VisibilityWindowNP.name))
+         {
+             IUUpdateNumber(&VisibilityWindowNP, values, names, n);
+             VisibilityWindowNP.s = IPS_OK;
+             IDSetNumber(&VisibilityWindowNP, NULL);
+             return true;
+         }
+
+         if (!strcmp(name, FlipLimitNP.name))
+         {
+             IUUpdateNumber(&FlipLimitNP, values, names, n);
+             FlipLimitNP.s = IPS_OK;
+             IDSetNumber(&FlipLimitNP, NULL);
+             return true;
+         }
+
          if(strcmp(name,"GUIDE_RATE")==0)
          {
+             // Used by the driver only; the answer to the client is coalesced
              IUUpdateNumber(&GuideRateNP, values, names, n);
-             GuideRateNP.s = IPS_OK;
-             IDSetNumber(&GuideRateNP, NULL);
+             double setting[2] = { GuideRateN[RA_AXIS].value, GuideRateN[DEC_AXIS].value };
+             postSetting(SETTING_GUIDE_RATE, setting, 2, "Guide rate");
              return true;
          }
 
@@ -695,50 +1418,87 @@ bool ScopeSiTech::ISNewSwitch (const char *dev, const char *name, ISState *state
 {
     if(strcmp(dev,getDeviceName())==0)
     {
+        // Abort latency counts from here; INDI::Telescope calls Abort() for us
+        if (!strcmp(name, AbortSP.name))
+            abortReceived = SiTechHostTime();
+
+        if (!strcmp(name, CaptureSP.name))
+        {
+            IUUpdateSwitch(&CaptureSP, states, names, n);
+            if (transport.isCapturing())
+            {
+                transport.stopCapture();
+                DEBUGF(INDI::Logger::DBG_SESSION, "Capture stopped, %llu bytes recorded.", (unsigned long long) transport.capturedBytes());
+            }
+            if (CaptureS[0].s == ISS_ON)
+                startSessionCapture();
+            else
+            {
+                CaptureSP.s = IPS_IDLE;
+                CaptureFileTP.s = IPS_IDLE;
+                IDSetText(&CaptureFileTP, NULL);
+            }
+            IDSetSwitch(&CaptureSP, NULL);
+            return true;
+        }
+
         // Tracking Mode
         if (!strcmp(TrackModeSP.name, name))
         {
-            int previousTrackMode = IUFindOnSwitchIndex(&TrackModeSP);
-
             IUUpdateSwitch(&TrackModeSP, states, names, n);
 
-            currentTrackMode = IUFindOnSwitchIndex(&TrackModeSP);
-
-            // Engage tracking?
-            bool enable     = (currentTrackMode != -1);
-            bool isSidereal = (currentTrackMode == TRACK_SIDEREAL);
-            double dRA=0, dDE=0;
-            if (currentTrackMode == TRACK_SOLAR)
-                dRA = TRACKRATE_SOLAR;
-            else if (currentTrackMode == TRACK_LUNAR)
-                dRA = TRACKRATE_LUNAR;
-            else if (currentTrackMode == TRACK_CUSTOM)
-            {
-                dRA = TrackRateN[RA_AXIS].value;
-                dDE = TrackRateN[DEC_AXIS].value;
-            }
+            // Sent once the changes stop coming, see flushSettings()
+            requestedTrackMode = IUFindOnSwitchIndex(&TrackModeSP);
+            double setting[3] = { (double) requestedTrackMode, TrackRateN[RA_AXIS].value, TrackRateN[DEC_AXIS].value };
+            postSetting(SETTING_TRACK, setting, 3, "Track mode");
+
+            TrackModeSP.s = IPS_BUSY;
+            IDSetSwitch(&TrackModeSP, NULL);
+            return true;
+        }
 
-            setSiTechTracking(enable, isSidereal, dRA, dDE);
+        if (!strcmp(name, ScheduleClearSP.name))
+        {
+            int n = scheduler.cancelAll();
+            DEBUGF(INDI::Logger::DBG_SESSION, "%d scheduled commands cancelled.", n);
+            IUResetSwitch(&ScheduleClearSP);
+            ScheduleClearSP.s = IPS_OK;
+            IDSetSwitch(&ScheduleClearSP, NULL);
+            updateScheduleStatus();
+            return true;
+        }
 
-            if(strstr(MessageFromScope,"SetTrackMode") == NULL)
+        if (!strcmp(name, CenterSP.name))
+        {
+            IUUpdateSwitch(&CenterSP, states, names, n);
+            if (CenterS[0].s == ISS_ON)
             {
-                sprintf(ErrorMessage, "SetTrackMode is rejected. Reason=%s",MessageFromScope);
-                DEBUG(INDI::Logger::DBG_SESSION,ErrorMessage);
-                TrackModeSP.s = IPS_ALERT;
-                if (previousTrackMode != -1)
-                {
-                    IUResetSwitch(&TrackModeSP);
-                    TrackModeS[previousTrackMode].s = ISS_ON;
-                }
+                if (CenterSolverT[0].text[0] == '\0')
+                    DEBUG(INDI::Logger::DBG_SESSION, "No solver (" CENTER_SOLVER_ENV " not set), send the measured offset to CENTER_OFFSET.");
+                startCentering();
+                if (centerer.isActive()) requestCenterMeasurement();
             }
+            else
+                stopCentering("stopped");
+            return true;
+        }
+
+        // Dedicated connection for Abort and guiding
+        if (!strcmp(name, PriorityLinkSP.name))
+        {
+            IUUpdateSwitch(&PriorityLinkSP, states, names, n);
+            bool enable = (PriorityLinkS[0].s == ISS_ON);
+            if (!isConnected())
+                PriorityLinkSP.s = IPS_IDLE;
+            else if (setPriorityLink(enable))
+                PriorityLinkSP.s = enable ? IPS_OK : IPS_IDLE;
             else
             {
-                sprintf(ErrorMessage, "SetTrackMode OK. Mess=%s",MessageFromScope);
-                DEBUG(INDI::Logger::DBG_SESSION, ErrorMessage);
-                if(IsTracking) TrackModeSP.s = IPS_OK; else TrackModeSP.s = IPS_IDLE;
+                IUResetSwitch(&PriorityLinkSP);
+                PriorityLinkS[1].s = ISS_ON;
+                PriorityLinkSP.s = IPS_ALERT;
             }
-
-            IDSetSwitch(&TrackModeSP, NULL);
+            IDSetSwitch(&PriorityLinkSP, NULL);
             return true;
         }
 
@@ -749,8 +1509,8 @@ bool ScopeSiTech::ISNewSwitch (const char *dev, const char *name, ISState *state
           if (IUUpdateSwitch(&SlewRateSP, states, names, n) < 0)
               return false;
 
-          SlewRateSP.s = IPS_OK;
-          IDSetSwitch(&SlewRateSP, NULL);
+          double setting[1] = { (double) IUFindOnSwitchIndex(&SlewRateSP) };
+          postSetting(SETTING_SLEW_RATE, setting, 1, "Slew rate");
           return true;
         }
     }
@@ -759,21 +1519,854 @@ bool ScopeSiTech::ISNewSwitch (const char *dev, const char *name, ISState *state
     return INDI::Telescope::ISNewSwitch(dev,name,states,names,n);
 }
 
-bool ScopeSiTech::Abort()
+bool ScopeSiTech::ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
 {
-    SetUpVarsFromReturnString(GetStringFromSerial((char *)"Abort"), true);//Stop all motion.
-    if(strstr(MessageFromScope,"Abort") == NULL)
+    if(strcmp(dev,getDeviceName())==0)
     {
-        sprintf(ErrorMessage, "Abort is rejected. Reason=%s",MessageFromScope);
-        DEBUG(INDI::Logger::DBG_SESSION,ErrorMessage);
-        return false;
-    }
-    sprintf(ErrorMessage, "Abort OK. Mess=%s",MessageFromScope);
-    IUResetSwitch(&TrackModeSP);
-    TrackModeSP.s = IPS_IDLE;
-    DEBUG(INDI::Logger::DBG_SESSION, ErrorMessage);
-    return true;
-}
+        if (!strcmp(name, ScheduleCommandTP.name))
+        {
+            IUUpdateText(&ScheduleCommandTP, texts, names, n);
+            ScheduleCommandTP.s = scheduleCommand(ScheduleCommandT[0].text, ScheduleCommandT[1].text) ? IPS_OK : IPS_ALERT;
+            IDSetText(&ScheduleCommandTP, NULL);
+            updateScheduleStatus();
+            return true;
+        }
+
+        if (!strcmp(name, HorizonFileTP.name))
+        {
+            IUUpdateText(&HorizonFileTP, texts, names, n);
+            if (HorizonFileT[0].text[0] == '\0')
+            {
+                horizonMask.clear();
+                HorizonFileTP.s = IPS_IDLE;
+                DEBUG(INDI::Logger::DBG_SESSION, "Horizon mask cleared.");
+            }
+            else
+            {
+                char err[MAXRBUF];
+                if (horizonMask.load(HorizonFileT[0].text, err, sizeof(err)))
+                {
+                    HorizonFileTP.s = IPS_OK;
+                    DEBUGF(INDI::Logger::DBG_SESSION, "Horizon mask loaded, limits %.1f to %.1f degrees.",
+                           horizonMask.lowestLimit(), horizonMask.highestLimit());
+                }
+                else
+                {
+                    HorizonFileTP.s = IPS_ALERT;
+                    DEBUGF(INDI::Logger::DBG_ERROR, "Horizon mask not loaded: %s", err);
+                }
+            }
+            IDSetText(&HorizonFileTP, NULL);
+            return true;
+        }
+    }
+
+    return INDI::Telescope::ISNewText(dev,name,texts,names,n);
+}
+
+bool ScopeSiTech::ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
+{
+    if(strcmp(dev,getDeviceName())==0 && !strcmp(name, VisibilityTargetsBP.name))
+    {
+        INDI_UNUSED(names);
+        if (n < 1 || strstr(formats[0], ".z") != NULL)
+        {
+            DEBUG(INDI::Logger::DBG_ERROR, "Visibility targets must be sent uncompressed.");
+            VisibilityTargetsBP.s = IPS_ALERT;
+            IDSetBLOB(&VisibilityTargetsBP, NULL);
+            return true;
+        }
+        VisibilityTargetsBP.s = screenTargets(blobs[0], blobsizes[0] < sizes[0] ? blobsizes[0] : sizes[0], formats[0]) ? IPS_OK : IPS_ALERT;
+        IDSetBLOB(&VisibilityTargetsBP, NULL);
+        return true;
+    }
+
+    return INDI::Telescope::ISNewBLOB(dev,name,sizes,blobsizes,blobs,formats,names,n);
+}
+
+/* Targets come as ".f64" (pairs of native doubles, RA hours then Dec degrees)
+ * or as text, one "ra dec" pair per line.  The answer goes to VISIBILITY_TABLE
+ * as a SiTechVisibilityHeader followed by one SiTechVisibility per target. */
+bool ScopeSiTech::screenTargets(const char *data, int len, const char *format)
+{
+    std::vector<double> ra, dec;
+    if (!strcmp(format, ".f64"))
+    {
+        size_t count = len / (2 * sizeof(double));
+        ra.resize(count);
+        dec.resize(count);
+        const double *pairs = (const double *) data;
+        for (size_t i = 0; i < count; i++)
+        {
+            ra[i] = pairs[i * 2];
+            dec[i] = pairs[i * 2 + 1];
+            if (!(ra[i] >= 0 && ra[i] < 24) || !(dec[i] >= -90 && dec[i] <= 90))
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Visibility target %d: RA %g or Dec %g is out of range.", (int) i + 1, ra[i], dec[i]);
+                return false;
+            }
+        }
+    }
+    else
+    {
+        std::string text(data, len);
+        const char *p = text.c_str();
+        for (int line = 1; *p; line++)
+        {
+            const char *eol = strchr(p, '\n');
+            std::string row(p, eol ? eol - p : strlen(p));
+            p = eol ? eol + 1 : p + row.size();
+
+            // A '#' starts a comment, on its own line or after the coordinates
+            size_t hash = row.find('#');
+            if (hash != std::string::npos) row.erase(hash);
+            const char *q = row.c_str();
+            while (isspace((unsigned char) *q)) q++;
+            if (*q == '\0') continue;
+
+            char *end;
+            double r = strtod(q, &end);
+            bool ok = (end != q);
+            q = end;
+            double d = ok ? strtod(q, &end) : 0;
+            ok = ok && end != q;
+            q = end;
+            while (ok && isspace((unsigned char) *q)) q++;
+            if (!ok || *q != '\0')
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Visibility targets line %d: expected \"RA(hours) Dec(degrees)\".", line);
+                return false;
+            }
+            if (!(r >= 0 && r < 24) || !(d >= -90 && d <= 90))
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Visibility targets line %d: RA %g or Dec %g is out of range.", line, r, d);
+                return false;
+            }
+            ra.push_back(r);
+            dec.push_back(d);
+        }
+    }
+    if (ra.empty())
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "No visibility targets found.");
+        return false;
+    }
+
+    // Sidereal time at the window start, from the mount's own sidereal time
+    double now = SiTechHostTime();
+    SiTechVisibilityWindow window;
+    double start = now + VisibilityWindowN[0].value * 3600;
+    double lastSample = (sampleTime > 0) ? sampleTime : now;
+    window.startLST    = scopeSiderealTime + (start - lastSample) / 3600 * SIDEREAL_PER_SOLAR;
+    window.latitude    = siteLatitude();
+    window.windowHours = VisibilityWindowN[1].value;
+    window.stepMinutes = VisibilityWindowN[2].value;
+
+    size_t count = ra.size();
+    visibilityTable.resize(sizeof(SiTechVisibilityHeader) + count * sizeof(SiTechVisibility));
+    SiTechVisibilityHeader *header = (SiTechVisibilityHeader *) &visibilityTable[0];
+    header->magic       = VIS_TABLE_MAGIC;
+    header->version     = VIS_TABLE_VERSION;
+    header->count       = count;
+    header->rowSize     = sizeof(SiTechVisibility);
+    header->startTime   = start;
+    header->startLST    = fmod(fmod(window.startLST, 24) + 24, 24);
+    header->windowHours = window.windowHours;
+    header->stepMinutes = window.stepMinutes;
+
+    SiTechVisibility *rows = (SiTechVisibility *) (&visibilityTable[0] + sizeof(SiTechVisibilityHeader));
+    SiTechScreenTargets(&ra[0], &dec[0], count, window, horizonMask, rows);
+    double took = SiTechHostTime() - now;
+
+    VisibilityTableB[0].blob    = &visibilityTable[0];
+    VisibilityTableB[0].bloblen = visibilityTable.size();
+    VisibilityTableB[0].size    = visibilityTable.size();
+    strncpy(VisibilityTableB[0].format, ".vis", MAXINDIFORMAT);
+    VisibilityTableBP.s = IPS_OK;
+    IDSetBLOB(&VisibilityTableBP, NULL);
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "Screened %d targets over %.1f h in %.1f ms.", (int) count, window.windowHours, took * 1000);
+    return true;
+}
+
+void ScopeSiTech::startCentering()
+{
+    if (IsParked || !IsTracking)
+    {
+        centerer.fail("the mount must be unparked and tracking");
+        reportCentering();
+        return;
+    }
+    centerer.start(CenterSettingsN[0].value, (int) CenterSettingsN[1].value, SiTechHostTime());
+    DEBUGF(INDI::Logger::DBG_SESSION, "Centering to within %.1f\" ...", CenterSettingsN[0].value);
+    reportCentering();
+}
+void ScopeSiTech::stopCentering(const char *why)
+{
+    stopCenterSolver();
+    if (!centerer.isActive())
+    {
+        CenterSP.s = IPS_IDLE;
+        IDSetSwitch(&CenterSP, NULL);
+        return;
+    }
+    centerer.stop();
+    DEBUGF(INDI::Logger::DBG_SESSION, "Centering %s.", why);
+    reportCentering();
+}
+/* Solver if there is one, otherwise ask the client for the offset */
+void ScopeSiTech::requestCenterMeasurement()
+{
+    if (CenterSolverT[0].text[0] == '\0')
+    {
+        CenterOffsetNP.s = IPS_BUSY;
+        IDSetNumber(&CenterOffsetNP, NULL);
+        return;
+    }
+    if (!runCenterSolver())
+    {
+        centerer.fail("solver could not be started");
+        reportCentering();
+    }
+}
+void ScopeSiTech::centerMeasured(double raArcsec, double decArcsec)
+{
+    if (!centerer.measured(raArcsec, decArcsec))
+    {
+        reportCentering();
+        return;
+    }
+
+    // Jogs at the guide rate or a short slew, whichever the mount gets done first
+    SiTechCenterMove move = SiTechPlanCenterMove(raArcsec, decArcsec, currentDEC,
+                                                 GuideRateN[RA_AXIS].value, GuideRateN[DEC_AXIS].value,
+                                                 mountClock.lastRoundTrip(), slewHistory);
+    if (!applyCenterMove(move))
+        centerer.fail("correction rejected");
+    reportCentering();
+}
+bool ScopeSiTech::applyCenterMove(const SiTechCenterMove &move)
+{
+    char cmd[2][64];
+    const char *cmds[2];
+    char *replies[2];
+    int count = 0;
+
+    if (move.method == CENTER_JOG)
+    {
+        if (fabs(move.raArcsec) >= 0.01)
+        {
+            SiTechEncodeJog(cmd[count], sizeof(cmd[count]), move.raArcsec > 0 ? 'E' : 'W', fabs(move.raArcsec));
+            count++;
+        }
+        if (fabs(move.decArcsec) >= 0.01)
+        {
+            SiTechEncodeJog(cmd[count], sizeof(cmd[count]), move.decArcsec > 0 ? 'N' : 'S', fabs(move.decArcsec));
+            count++;
+        }
+    }
+    else
+    {
+        SiTechEncodeOffsetDestination(cmd[0], sizeof(cmd[0]), move.raHours, move.decDegrees);
+        count = 1;
+    }
+    for (int i = 0; i < count; i++) cmds[i] = cmd[i];
+
+    if (count == 0 || GetStringsFromSerial(cmds, count, replies) < count)
+        return false;
+    SetUpVarsFromReturnString(replies[count - 1], false);
+
+    trackingAnalyzer.holdFor(lastSendTime, move.expectedSeconds);
+
+    centerMethod = move.method;
+    centerMoveDistance = move.distance;
+    centerer.moveSent(lastSendTime, move.expectedSeconds);
+    DEBUGF(INDI::Logger::DBG_DEBUG, "Centering correction %d: %s (%.1f\" RA axis, %.1f\" Dec), expect %.1f s",
+           centerer.iterations(), cmd[0], move.raArcsec, move.decArcsec, move.expectedSeconds);
+    return true;
+}
+void ScopeSiTech::updateCentering()
+{
+    if (centerer.state() != CENTER_MOVING) return;
+
+    if (centerer.update(scopeStatusBits, sampleTime))
+    {
+        // A destination offset is a slew of its own, and teaches the settle time
+        if (centerMethod == CENTER_OFFSET && centerer.sawSlew())
+            slewHistory.record(centerMoveDistance, sampleTime - centerer.moveStart());
+        requestCenterMeasurement();
+    }
+    if (centerer.state() == CENTER_FAILED)
+        reportCentering();
+}
+void ScopeSiTech::reportCentering()
+{
+    double now = SiTechHostTime();
+    CenterStatusN[0].value = centerer.iterations();
+    CenterStatusN[1].value = centerer.lastError();
+    CenterStatusN[2].value = (centerer.state() == CENTER_IDLE) ? 0 : centerer.elapsed(now);
+
+    switch (centerer.state())
+    {
+        case CENTER_DONE:
+            CenterStatusNP.s = IPS_OK;
+            DEBUGF(INDI::Logger::DBG_SESSION, "Centered to %.1f\" after %d corrections in %.1f s.",
+                   centerer.lastError(), centerer.iterations(), centerer.elapsed(now));
+            break;
+        case CENTER_FAILED:
+            CenterStatusNP.s = IPS_ALERT;
+            DEBUGF(INDI::Logger::DBG_ERROR, "Centering failed: %s.", centerer.reason());
+            break;
+        case CENTER_IDLE:
+            CenterStatusNP.s = IPS_IDLE;
+            break;
+        default:
+            CenterStatusNP.s = IPS_BUSY;
+            break;
+    }
+    IDSetNumber(&CenterStatusNP, NULL);
+
+    CenterOffsetNP.s = (centerer.state() == CENTER_FAILED) ? IPS_ALERT : (centerer.isActive() ? IPS_OK : IPS_IDLE);
+    IDSetNumber(&CenterOffsetNP, NULL);
+
+    if (!centerer.isActive() && CenterS[0].s == ISS_ON)
+    {
+        IUResetSwitch(&CenterSP);
+        CenterS[1].s = ISS_ON;
+    }
+    CenterSP.s = CenterStatusNP.s;
+    IDSetSwitch(&CenterSP, NULL);
+}
+/* The solver program is run as "<program> <RA hours> <Dec degrees>" for the
+ * last GoTo target, without a shell, and prints the target's offset from the
+ * image centre as "<RA arcsec> <Dec arcsec>" on its last line.  Its output is
+ * read from the event loop so the driver keeps polling while it runs. */
+bool ScopeSiTech::runCenterSolver()
+{
+    if (centerSolverPid > 0) return true;       // still running, its answer will do
+
+    // Everything the child needs is made before the fork; other threads may hold locks
+    char raArg[32], decArg[32];
+    snprintf(raArg, sizeof(raArg), "%.6f", targetRA);
+    snprintf(decArg, sizeof(decArg), "%.6f", targetDEC);
+    char *const argv[] = { CenterSolverT[0].text, raArg, decArg, NULL };
+
+    // stdin is the indiserver pipe: the solver gets /dev/null instead, and none of our other fds
+    long maxFd = sysconf(_SC_OPEN_MAX);
+    if (maxFd < 0 || maxFd > 65536) maxFd = 65536;
+    int out[2];
+    int devNull = open("/dev/null", O_RDONLY);
+    if (devNull < 0 || pipe(out) != 0)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Cannot run solver: %s", strerror(errno));
+        if (devNull >= 0) close(devNull);
+        return false;
+    }
+    fcntl(out[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Cannot run solver: %s", strerror(errno));
+        close(out[0]);
+        close(out[1]);
+        close(devNull);
+        return false;
+    }
+    if (pid == 0)
+    {
+        dup2(devNull, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        for (int fd = STDERR_FILENO + 1; fd < maxFd; fd++)
+            close(fd);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(out[1]);
+    close(devNull);
+    centerSolverPid = pid;
+    centerSolverFd = out[0];
+    centerSolverLen = 0;
+    centerSolverCB = IEAddCallback(centerSolverFd, centerSolverHelper, this);
+    centerSolverTimerID = IEAddTimer(CENTER_SOLVER_TIMEOUT * 1000, centerSolverTimeoutHelper, this);
+    DEBUGF(INDI::Logger::DBG_DEBUG, "Solver: %s %s %s", argv[0], raArg, decArg);
+    return true;
+}
+void ScopeSiTech::centerSolverHelper(int fd, void *p)
+{
+    static_cast<ScopeSiTech *>(p)->readCenterSolver(fd);
+}
+void ScopeSiTech::readCenterSolver(int fd)
+{
+    ssize_t n = read(fd, centerSolverOutput + centerSolverLen, sizeof(centerSolverOutput) - 1 - centerSolverLen);
+    if (n < 0 && errno == EINTR) return;
+    if (n > 0)
+    {
+        centerSolverLen += n;
+        if (centerSolverLen < sizeof(centerSolverOutput) - 1) return;
+    }
+
+    IERmCallback(centerSolverCB);
+    centerSolverCB = 0;
+    close(centerSolverFd);
+    centerSolverFd = -1;
+    centerSolverOutput[centerSolverLen] = '\0';
+    reapCenterSolver();
+}
+/* The output is in; wait for the exit status without blocking the event loop.
+ * The timeout still stands for a solver that closed its output and hangs. */
+void ScopeSiTech::reapCenterSolver()
+{
+    centerSolverReapID = 0;
+    int wstatus = 0;
+    pid_t pid = waitpid(centerSolverPid, &wstatus, WNOHANG);
+    if (pid == 0 || (pid < 0 && errno == EINTR))
+    {
+        centerSolverReapID = IEAddTimer(CENTER_SOLVER_REAP_MS, centerSolverReapHelper, this);
+        return;
+    }
+    if (centerSolverTimerID > 0) IERmTimer(centerSolverTimerID);
+    centerSolverTimerID = 0;
+    centerSolverPid = -1;
+    finishCenterSolver((pid > 0 && WIFEXITED(wstatus)) ? WEXITSTATUS(wstatus) : -1);
+}
+void ScopeSiTech::centerSolverReapHelper(void *p)
+{
+    static_cast<ScopeSiTech *>(p)->reapCenterSolver();
+}
+void ScopeSiTech::centerSolverTimeoutHelper(void *p)
+{
+    ScopeSiTech *scope = static_cast<ScopeSiTech *>(p);
+    scope->centerSolverTimerID = 0;
+    scope->timeoutCenterSolver();
+}
+void ScopeSiTech::timeoutCenterSolver()
+{
+    DEBUGF(INDI::Logger::DBG_ERROR, "Solver still running after %d s, killed.", CENTER_SOLVER_TIMEOUT);
+    stopCenterSolver();
+    if (centerer.state() != CENTER_MEASURING) return;
+    centerer.fail("solver timed out");
+    reportCentering();
+}
+/* Kill and reap a running solver and forget its output */
+void ScopeSiTech::stopCenterSolver()
+{
+    if (centerSolverCB > 0) IERmCallback(centerSolverCB);
+    centerSolverCB = 0;
+    if (centerSolverTimerID > 0) IERmTimer(centerSolverTimerID);
+    centerSolverTimerID = 0;
+    if (centerSolverReapID > 0) IERmTimer(centerSolverReapID);
+    centerSolverReapID = 0;
+    if (centerSolverFd >= 0) close(centerSolverFd);
+    centerSolverFd = -1;
+    if (centerSolverPid > 0)
+    {
+        // SIGKILL cannot be ignored, so this wait is short
+        kill(centerSolverPid, SIGKILL);
+        while (waitpid(centerSolverPid, NULL, 0) < 0 && errno == EINTR) ;
+    }
+    centerSolverPid = -1;
+}
+void ScopeSiTech::finishCenterSolver(int status)
+{
+    // Stopped while the solver ran
+    if (centerer.state() != CENTER_MEASURING) return;
+
+    bool found = false;
+    double ra = 0, dec = 0;
+    for (char *line = strtok(centerSolverOutput, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        double r, d;
+        if (sscanf(line, "%lf %lf", &r, &d) == 2)
+        {
+            ra = r;
+            dec = d;
+            found = true;
+        }
+    }
+    if (status != 0 || !found)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Solver failed (exit status %d), no offset.", status);
+        centerer.fail("no offset from the solver");
+        reportCentering();
+        return;
+    }
+
+    CenterOffsetN[0].value = ra;
+    CenterOffsetN[1].value = dec;
+    centerMeasured(ra, dec);
+}
+
+/* "YYYY-MM-DDTHH:MM:SS[.sss][Z]" UTC, or unix seconds */
+static bool parseUTC(const char *text, double *t)
+{
+    int year, month, day, hour, minute;
+    double second;
+    if (sscanf(text, "%d-%d-%dT%d:%d:%lf", &year, &month, &day, &hour, &minute, &second) == 6)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = year - 1900;
+        tm.tm_mon  = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_min  = minute;
+        *t = timegm(&tm) + second;
+        return true;
+    }
+    char *end;
+    *t = strtod(text, &end);
+    return end != text && *t > 0;
+}
+static void formatUTC(double t, char *out, size_t len)
+{
+    time_t whole = (time_t) floor(t);
+    struct tm tm;
+    gmtime_r(&whole, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(out, len, "%s.%03d", stamp, (int) ((t - whole) * 1000));
+}
+/* Exactly count finite numbers separated by blanks and nothing else, so a
+ * client line can neither smuggle in a second command nor skip a check. */
+static bool readNumbers(const char *text, double *out, int count)
+{
+    for (const char *c = text; *c; c++)
+        if (iscntrl((unsigned char) *c) && *c != '\t') return false;
+    for (int i = 0; i < count; i++)
+    {
+        char *end;
+        out[i] = strtod(text, &end);
+        if (end == text || !std::isfinite(out[i])) return false;
+        text = end;
+    }
+    while (*text == ' ' || *text == '\t') text++;
+    return *text == '\0';
+}
+static bool isFlag(double v)
+{
+    return v == 0 || v == 1;
+}
+/* Track mode switch for a SetTrackMode command, -1 when it stops tracking */
+static int trackModeFor(bool track, bool useRates, double raRate, double deRate)
+{
+    if (!track) return -1;
+    if (!useRates) return INDI::Telescope::TRACK_SIDEREAL;
+    if (fabs(deRate) < 1e-6 && fabs(raRate - TRACKRATE_SOLAR) < 1e-6) return INDI::Telescope::TRACK_SOLAR;
+    if (fabs(deRate) < 1e-6 && fabs(raRate - TRACKRATE_LUNAR) < 1e-6) return INDI::Telescope::TRACK_LUNAR;
+    return INDI::Telescope::TRACK_CUSTOM;
+}
+bool ScopeSiTech::scheduleCommand(const char *utc, const char *command)
+{
+    double when;
+    if (!parseUTC(utc, &when))
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Cannot read the schedule time '%s'.", utc);
+        return false;
+    }
+
+    // The line sent is rebuilt from the parsed values, never the client's text
+    char line[SCHEDULE_CMD_LEN];
+    double v[4];
+    bool isGoTo = false, isAltAz = false;
+    if (!strncmp(command, "GoTo ", 5))
+    {
+        if (!readNumbers(command + 5, v, 2) || v[0] < 0 || v[0] >= 24 || v[1] < -90 || v[1] > 90)
+        {
+            DEBUG(INDI::Logger::DBG_ERROR, "GoTo needs RA (0 to 24 hours) and Dec (-90 to 90 degrees).");
+            return false;
+        }
+        SiTechEncodeGoTo(line, sizeof(line), v[0], v[1]);
+        isGoTo = true;
+    }
+    else if (!strncmp(command, "GoToAltAz ", 10))
+    {
+        if (!readNumbers(command + 10, v, 2) || v[0] < 0 || v[0] >= 360 || v[1] < -90 || v[1] > 90)
+        {
+            DEBUG(INDI::Logger::DBG_ERROR, "GoToAltAz needs Az (0 to 360 degrees) and Alt (-90 to 90 degrees).");
+            return false;
+        }
+        SiTechEncodeGoToAltAz(line, sizeof(line), v[0], v[1]);
+        isAltAz = true;
+    }
+    else if (!strncmp(command, "SetTrackMode ", 13))
+    {
+        if (!readNumbers(command + 13, v, 4) || !isFlag(v[0]) || !isFlag(v[1])
+                || fabs(v[2]) > TrackRateN[RA_AXIS].max || fabs(v[3]) > TrackRateN[DEC_AXIS].max)
+        {
+            DEBUGF(INDI::Logger::DBG_ERROR, "SetTrackMode needs track (0/1), use rates (0/1) and RA and Dec rates up to %.0f \"/s.",
+                   TrackRateN[RA_AXIS].max);
+            return false;
+        }
+        SiTechEncodeSetTrackMode(line, sizeof(line), v[0] == 1, v[1] == 1, v[2], v[3]);
+    }
+    else
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "Only GoTo, GoToAltAz and SetTrackMode can be scheduled.");
+        return false;
+    }
+
+    if (IsParked)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "Please unpark the mount before scheduling motion commands.");
+        return false;
+    }
+    if (!mountClock.isValid())
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "The mount clock is not known yet, try again in a few seconds.");
+        return false;
+    }
+    double now = mountClock.hostToMount(SiTechHostTime());
+    if (when < now)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Schedule time %s is already past.", utc);
+        return false;
+    }
+
+    // A GoTo is checked against the horizon mask where the target will be when it fires, a GoToAltAz where it points
+    double alt = 0, az = 0;
+    if (isGoTo)
+    {
+        double lst = scopeSiderealTime + (when - mountClock.hostToMount(sampleTime)) / 3600 * SIDEREAL_PER_SOLAR;
+        SiTechEquToHorizontal(lst - v[0], v[1], siteLatitude(), &alt, &az);
+    }
+    else if (isAltAz)
+    {
+        az = v[0];
+        alt = v[1];
+    }
+    if ((isGoTo || isAltAz) && horizonMask.isLoaded() && !horizonMask.isAbove(alt, az))
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Target will be below the horizon mask then (alt %.1f at az %.1f).", alt, az);
+        return false;
+    }
+
+    int id = scheduler.add(line, when);
+    if (id < 0)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "Schedule queue is full or not running.");
+        return false;
+    }
+    char stamp[64];
+    formatUTC(when, stamp, sizeof(stamp));
+    DEBUGF(INDI::Logger::DBG_SESSION, "Scheduled #%d '%s' at %s UTC (in %.1f s).", id, line, stamp, when - now);
+    return true;
+}
+void ScopeSiTech::updateScheduleStatus()
+{
+    double when;
+    char command[SCHEDULE_CMD_LEN], stamp[64];
+    if (scheduler.next(&when, command, sizeof(command)))
+    {
+        formatUTC(when, stamp, sizeof(stamp));
+        IUSaveText(&ScheduleNextT[0], stamp);
+        IUSaveText(&ScheduleNextT[1], command);
+        ScheduleNextTP.s = IPS_BUSY;
+    }
+    else
+    {
+        IUSaveText(&ScheduleNextT[0], "");
+        IUSaveText(&ScheduleNextT[1], "");
+        ScheduleNextTP.s = IPS_IDLE;
+    }
+    IDSetText(&ScheduleNextTP, NULL);
+
+    ScheduleResultN[0].value = scheduler.pending();
+    IDSetNumber(&ScheduleResultNP, NULL);
+}
+/* A scheduled command was accepted: the driver's state follows it as if a
+ * client had asked for it just now.  command is the line the driver built. */
+void ScopeSiTech::scheduledCommandFired(const char *command)
+{
+    double v[4];
+    if (!strncmp(command, "GoTo ", 5) && sscanf(command + 5, "%lf %lf", &v[0], &v[1]) == 2)
+    {
+        char *reply = GetStringFromSerial((char *) "ReadScopeDestination");
+        beginSlew(v[0], v[1], SiTechSlewHistory::distance(currentRA, currentDEC, v[0], v[1]), reply);
+    }
+    else if (!strncmp(command, "GoToAltAz ", 10))
+    {
+        // The RA and Dec to slew to are only known from the mount
+        char *reply = GetStringFromSerial((char *) "ReadScopeDestination");
+        double fields[11];
+        if (reply != NULL && SiTechParseFields(reply, fields, 11) >= 9)
+            beginSlew(fields[5], fields[6], SiTechSlewHistory::distance(currentRA, currentDEC, fields[5], fields[6]), reply);
+        else
+        {
+            EqNP.s = IPS_BUSY;
+            IDSetNumber(&EqNP, NULL);
+        }
+    }
+    else if (!strncmp(command, "SetTrackMode ", 13) && sscanf(command + 13, "%lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3]) == 4)
+    {
+        currentTrackMode = requestedTrackMode = trackModeFor(v[0] == 1, v[1] == 1, v[2], v[3]);
+        IUResetSwitch(&TrackModeSP);
+        if (currentTrackMode != -1) TrackModeS[currentTrackMode].s = ISS_ON;
+        TrackModeSP.s = IsTracking ? IPS_OK : IPS_IDLE;
+        IDSetSwitch(&TrackModeSP, NULL);
+        if (currentTrackMode == TRACK_CUSTOM)
+        {
+            TrackRateN[RA_AXIS].value  = v[2];
+            TrackRateN[DEC_AXIS].value = v[3];
+            TrackRateNP.s = IPS_OK;
+            IDSetNumber(&TrackRateNP, NULL);
+        }
+    }
+}
+/* Nothing queued may fire after the user has stopped or parked the mount */
+void ScopeSiTech::cancelSchedule(const char *why)
+{
+    int n = scheduler.cancelAll();
+    if (n == 0) return;
+    DEBUGF(INDI::Logger::DBG_SESSION, "%d scheduled commands cancelled by %s.", n, why);
+    updateScheduleStatus();
+}
+void ScopeSiTech::statusHelper(int fd, void *p)
+{
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+    static_cast<ScopeSiTech *>(p)->ReadScopeStatus();
+}
+void ScopeSiTech::scheduleResultHelper(int fd, void *p)
+{
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+    static_cast<ScopeSiTech *>(p)->readScheduleResults();
+}
+/* Runs on the main thread: results from the dispatch thread become property updates here */
+void ScopeSiTech::readScheduleResults()
+{
+    SiTechScheduledResult results[8];
+    int n;
+    while ((n = scheduler.takeResults(results, 8)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            SiTechScheduledResult &r = results[i];
+            char stamp[64];
+            formatUTC(r.requested, stamp, sizeof(stamp));
+            if (r.held)
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Scheduled #%d '%s' for %s UTC not sent, the mount is parked.", r.id, r.command, stamp);
+                ScheduleResultNP.s = IPS_ALERT;
+                continue;
+            }
+            if (r.missed)
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Scheduled #%d '%s' for %s UTC missed, not sent.", r.id, r.command, stamp);
+                ScheduleResultNP.s = IPS_ALERT;
+                continue;
+            }
+            if (r.status != SITECH_OK)
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Scheduled #%d '%s' failed: %s", r.id, r.command, SiTechLinkErrorString(r.status));
+                ScheduleResultNP.s = IPS_ALERT;
+                continue;
+            }
+
+            // The reply is a status frame, and one more clock sample
+            lastSendTime = r.sendTime;
+            lastReceiveTime = r.receiveTime;
+            MessageFromScope[0] = '\0';
+            SetUpVarsFromReturnString(r.reply, true);
+
+            double error = (r.fired - r.requested) * 1000;
+            double rtt = (r.receiveTime - r.sendTime) * 1000;
+            ScheduleResultN[1].value = error;
+            ScheduleResultN[2].value = rtt;
+
+            // A reply only says the line arrived; SiTechExe names the command when it takes it
+            std::string name(r.command, strcspn(r.command, " "));
+            if (strstr(MessageFromScope, name.c_str()) == NULL)
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "Scheduled #%d '%s' is rejected. Reason=%s", r.id, r.command, MessageFromScope);
+                ScheduleResultNP.s = IPS_ALERT;
+                continue;
+            }
+            ScheduleResultNP.s = (fabs(error) > SCHEDULE_TOLERANCE_MS) ? IPS_ALERT : IPS_OK;
+            DEBUGF(INDI::Logger::DBG_SESSION, "Scheduled #%d '%s' for %s UTC fired %+.1f ms from the requested time (round trip %.1f ms). Mess=%s",
+                   r.id, r.command, stamp, error, rtt, MessageFromScope);
+
+            scheduledCommandFired(r.command);
+        }
+    }
+    updateScheduleStatus();
+}
+
+bool ScopeSiTech::saveConfigItems(FILE *fp)
+{
+    INDI::Telescope::saveConfigItems(fp);
+
+    IUSaveConfigText(fp, &HorizonFileTP);
+    IUSaveConfigNumber(fp, &FlipLimitNP);
+    IUSaveConfigNumber(fp, &VisibilityWindowNP);
+    IUSaveConfigNumber(fp, &GuideRateNP);
+    IUSaveConfigSwitch(fp, &PriorityLinkSP);
+    IUSaveConfigNumber(fp, &CenterSettingsNP);
+
+    return true;
+}
+
+bool ScopeSiTech::Abort()
+{
+    double received = (abortReceived > 0) ? abortReceived : SiTechHostTime();
+    abortReceived = 0;
+
+    // Whatever the mount answers, nothing of ours may start it moving again
+    if (slewTimed)
+    {
+        // An aborted slew says nothing about how long a full one takes
+        slewTimed = false;
+        SlewDestinationNP.s = IPS_IDLE;
+        IDSetNumber(&SlewDestinationNP, NULL);
+    }
+    if (centerer.isActive())
+        stopCentering("aborted");
+    cancelSchedule("Abort");
+
+    // Abort stops tracking; a track change still waiting must not restart it
+    double dropped[SETTING_MAX_VALUES];
+    if (pendingSettings.take(SETTING_TRACK, dropped))
+    {
+        DEBUG(INDI::Logger::DBG_SESSION, "Pending track mode change dropped by Abort.");
+        if (TrackRateNP.s == IPS_BUSY)
+        {
+            TrackRateNP.s = IPS_IDLE;
+            IDSetNumber(&TrackRateNP, NULL);
+        }
+    }
+    currentTrackMode = requestedTrackMode = -1;
+    IUResetSwitch(&TrackModeSP);
+    TrackModeSP.s = IPS_IDLE;
+
+    // Stop all motion, and read back the state in the same round trip
+    const char *cmds[2] = { "Abort", "ReadScopeStatus" };
+    char *replies[2];
+    int got = GetStringsFromSerial(cmds, 2, replies);
+    if (got > 0)
+    {
+        abortLatency = lastReceiveTime - received;
+        if (abortLatency > abortMaxLatency) abortMaxLatency = abortLatency;
+        abortCount++;
+    }
+    updateLaneLatency();
+    if (got < 1)
+        return false;
+    SetUpVarsFromReturnString(replies[0], true);
+    if (got > 1) refreshStatusFrom(replies[1]);
+    if(strstr(MessageFromScope,"Abort") == NULL)
+    {
+        sprintf(ErrorMessage, "Abort is rejected. Reason=%s",MessageFromScope);
+        DEBUG(INDI::Logger::DBG_SESSION,ErrorMessage);
+        return false;
+    }
+    sprintf(ErrorMessage, "Abort OK. Mess=%s",MessageFromScope);
+    DEBUG(INDI::Logger::DBG_SESSION, ErrorMessage);
+    return true;
+}
 
 
 bool ScopeSiTech::MoveNS(INDI_DIR_NS dir, TelescopeMotionCommand command)
@@ -798,36 +2391,74 @@ bool ScopeSiTech::MoveWE(INDI_DIR_WE dir, TelescopeMotionCommand command)
     return true;
 }
 
+/* PulseGuide directions: 0=North, 1=South, 2=East, 3=West */
+IPState ScopeSiTech::sendPulseGuide(int direction, float ms)
+{
+    if (TrackState == SCOPE_PARKED)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "Please unpark the mount before issuing any motion commands.");
+        return IPS_ALERT;
+    }
+
+    char cmd[64];
+    SiTechEncodePulseGuide(cmd, sizeof(cmd), (SiTechGuideDirection) direction, (int) ms);
+    if (!SetUpVarsFromReturnString(GetStringFromSerial(cmd), false))
+        return IPS_ALERT;
+    updateLaneLatency();
+    trackingAnalyzer.holdFor(lastSendTime, ms / 1000.0);
+
+    // The guider interface expects us to say when the pulse is over
+    bool isNS = (direction < 2);
+    int &timer = isNS ? guideNSTimerID : guideWETimerID;
+    if (timer > 0) IERmTimer(timer);
+    timer = IEAddTimer((int) ms, isNS ? guideNSTimeoutHelper : guideWETimeoutHelper, this);
+    return IPS_BUSY;
+}
+
+void ScopeSiTech::guideNSTimeoutHelper(void *p)
+{
+    ScopeSiTech *scope = static_cast<ScopeSiTech *>(p);
+    scope->guideNSTimerID = 0;
+    scope->GuideNSN[0].value = scope->GuideNSN[1].value = 0;
+    scope->GuideNSNP.s = IPS_IDLE;
+    IDSetNumber(&scope->GuideNSNP, NULL);
+}
+
+void ScopeSiTech::guideWETimeoutHelper(void *p)
+{
+    ScopeSiTech *scope = static_cast<ScopeSiTech *>(p);
+    scope->guideWETimerID = 0;
+    scope->GuideWEN[0].value = scope->GuideWEN[1].value = 0;
+    scope->GuideWENP.s = IPS_IDLE;
+    IDSetNumber(&scope->GuideWENP, NULL);
+}
+
 IPState ScopeSiTech::GuideNorth(float ms)
 {
     guiderNSTarget[GUIDE_NORTH] = ms;
     guiderNSTarget[GUIDE_SOUTH] = 0;
-    return IPS_BUSY;
+    return sendPulseGuide(0, ms);
 }
 
 IPState ScopeSiTech::GuideSouth(float ms)
 {
     guiderNSTarget[GUIDE_SOUTH] = ms;
     guiderNSTarget[GUIDE_NORTH] = 0;
-    return IPS_BUSY;
-
+    return sendPulseGuide(1, ms);
 }
 
 IPState ScopeSiTech::GuideEast(float ms)
 {
-
     guiderEWTarget[GUIDE_EAST] = ms;
     guiderEWTarget[GUIDE_WEST] = 0;
-    return IPS_BUSY;
-
+    return sendPulseGuide(2, ms);
 }
 
 IPState ScopeSiTech::GuideWest(float ms)
 {
     guiderEWTarget[GUIDE_WEST] = ms;
     guiderEWTarget[GUIDE_EAST] = 0;
-    return IPS_BUSY;
-
+    return sendPulseGuide(3, ms);
 }
 
 bool ScopeSiTech::SetCurrentPark()
@@ -24,6 +24,20 @@
 #include "indidevapi.h"
 #include "indicom.h"
 #include "indibase/baseclient.h"
+#include "sitech_shm.h"
+#include "sitech_horizon.h"
+#include "sitech_clock.h"
+#include "sitech_slew.h"
+#include "sitech_transport.h"
+#include "sitech_client.h"
+#include "sitech_protocol.h"
+#include "sitech_pec.h"
+#include "sitech_visibility.h"
+#include "sitech_center.h"
+#include "sitech_settings.h"
+#include "sitech_schedule.h"
+
+#include <vector>
 class ScopeSiTech : public INDI::Telescope, public INDI::GuiderInterface
 {
 public:
@@ -33,7 +47,7 @@ public:
     virtual const char *getDefaultName();
     virtual bool Handshake();
 //    virtual bool Connect();
-//    virtual bool Disconnect();
+    virtual bool Disconnect();
     virtual bool ReadScopeStatus();
     virtual bool initProperties();
     virtual void ISGetProperties (const char *dev);
@@ -41,6 +55,8 @@ public:
 
     virtual bool ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n);
     virtual bool ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n);
+    virtual bool ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n);
+    virtual bool ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n);
 
     protected:
 
@@ -62,12 +78,101 @@ public:
     virtual bool SetCurrentPark();
     virtual bool SetDefaultPark();
 
+    virtual bool saveConfigItems(FILE *fp);
+
     private:
     bool SetUpVarsFromReturnString(char * ScopeAnswer, bool PrintBools);
     bool setSiTechTracking(bool enable, bool isSidereal, double raRate, double deRate);
-    int currentTrackMode;
+    void publishStatusSegment();
+    bool readSiteLocation(const char * reply);
+    double siteLatitude();
+    void updateLimitTimes();
+    void updateClockSync();
+    bool readScopeDestination(const char * reply, double ra, double dec);
+    void refreshStatusFrom(char * reply);
+    void updateSlewTiming();
+    bool setPriorityLink(bool enable);
+    void updateLaneLatency();
+    void startSessionCapture();
+    void checkSessionCapture();
+    IPState sendPulseGuide(int direction, float ms);
+    double expectedTrackRate();
+    void updateTrackingAnalysis();
+    bool screenTargets(const char *data, int len, const char *format);
+    void startCentering();
+    void stopCentering(const char *why);
+    void requestCenterMeasurement();
+    void centerMeasured(double raArcsec, double decArcsec);
+    bool applyCenterMove(const SiTechCenterMove &move);
+    void updateCentering();
+    void reportCentering();
+    bool runCenterSolver();
+    void readCenterSolver(int fd);
+    void reapCenterSolver();
+    void finishCenterSolver(int status);
+    void stopCenterSolver();
+    void timeoutCenterSolver();
+    static void centerSolverHelper(int fd, void *p);
+    static void centerSolverReapHelper(void *p);
+    static void centerSolverTimeoutHelper(void *p);
+    static void guideNSTimeoutHelper(void *p);
+    static void guideWETimeoutHelper(void *p);
+    void postSetting(SiTechSetting slot, const double *values, int count, const char *label);
+    void flushSettings();
+    void applyTrackSetting(int mode, double raRate, double deRate, unsigned superseded);
+    static void settingsFlushHelper(void *p);
+    bool scheduleCommand(const char *utc, const char *command);
+    void updateScheduleStatus();
+    void cancelSchedule(const char *why);
+    void readScheduleResults();
+    void scheduledCommandFired(const char *command);
+    void beginSlew(double ra, double dec, double distance, const char *destination);
+    static void scheduleResultHelper(int fd, void *p);
+    static void statusHelper(int fd, void *p);
+    int currentTrackMode;               /* as last accepted by the mount */
+    int requestedTrackMode;             /* as last asked for by a client */
+
+    // Client setting changes, latest value wins
+    SiTechSettingQueue pendingSettings;
+    int settingsTimerID;
 
     char * GetStringFromSerial(char * Send);
+    int GetStringsFromSerial(const char **commands, int count, char **replies);
+
+    // All SiTechExe traffic goes through the client; transport is its link, by priority lane
+    SiTechClient mount;
+    SiTechTransport &transport;
+    ISwitch PriorityLinkS[2];
+    ISwitchVectorProperty PriorityLinkSP;
+    INumber LaneLatencyN[4];
+    INumberVectorProperty LaneLatencyNP;
+    uint64_t lastLaneCount;
+    double abortReceived;               /* when the last Abort request reached the driver */
+    double abortLatency, abortMaxLatency;
+    uint64_t abortCount;
+
+    // Status frames polled on the client's thread, taken by the event loop
+    int statusCB;
+    double lastPollSend;
+    int reportedPollError;
+    ISwitch CaptureS[2];
+    ISwitchVectorProperty CaptureSP;
+    IText CaptureFileT[1];
+    ITextVectorProperty CaptureFileTP;
+
+    // Time-tagged commands, fired by their own thread through the transport
+    SiTechScheduler scheduler;
+    int scheduleCB;
+    IText ScheduleCommandT[2];
+    ITextVectorProperty ScheduleCommandTP;
+    ISwitch ScheduleClearS[1];
+    ISwitchVectorProperty ScheduleClearSP;
+    IText ScheduleNextT[2];
+    ITextVectorProperty ScheduleNextTP;
+    INumber ScheduleResultN[3];
+    INumberVectorProperty ScheduleResultNP;
+    int guideNSTimerID;
+    int guideWETimerID;
     double currentRA;
     double currentDEC;
     double currentAlt;
@@ -77,6 +182,10 @@ public:
     double scopeSiderealTime;
     double scopeJulianDay;
     double scopeTime;
+    int scopeStatusBits;
+
+    // Latest status frame for co-located consumers, see sitech_shm.h
+    SiTechShmWriter statusSegment;
 
     double targetRA;
     double targetDEC;
@@ -94,6 +203,82 @@ public:
     double guiderEWTarget[2];
     double guiderNSTarget[2];
 
+    // Host/mount clock estimate; every status sample is tagged with the
+    // host time at the midpoint of its exchange
+    SiTechClockEstimator mountClock;
+    double lastSendTime;
+    double lastReceiveTime;
+    double sampleTime;
+    double lastClockReport;
+    INumber ClockSyncN[4];
+    INumberVectorProperty ClockSyncNP;
+
+    // Slew destination for dome slaving and the slew duration model
+    SiTechSlewHistory slewHistory;
+    bool slewTimed;
+    bool slewSeen;
+    double slewStartTime;
+    double slewDistance;
+    double slewEstimate;
+    INumber SlewDestinationN[5];
+    INumberVectorProperty SlewDestinationNP;
+
+    // Tracking error and periodic error from the axis angles
+    SiTechTrackingAnalyzer trackingAnalyzer;
+    int analysedTrackMode;
+    int analysedAxis;               /* -1 until known, 0 primary, 1 secondary */
+    double analysedAxisStart[2];
+    double analysedTimeStart;
+    double lastPEReport;
+    INumber TrackingErrorN[3];
+    INumberVectorProperty TrackingErrorNP;
+    INumber PESpectrumN[PE_PEAKS * 2];
+    INumberVectorProperty PESpectrumNP;
+
+    // Target list visibility screening
+    INumber VisibilityWindowN[3];
+    INumberVectorProperty VisibilityWindowNP;
+    IBLOB VisibilityTargetsB[1];
+    IBLOBVectorProperty VisibilityTargetsBP;
+    IBLOB VisibilityTableB[1];
+    IBLOBVectorProperty VisibilityTableBP;
+    std::vector<char> visibilityTable;
+
+    // Closed-loop centering on a measured offset, see sitech_center.h
+    SiTechCenterer centerer;
+    SiTechCenterMethod centerMethod;
+    double centerMoveDistance;
+    pid_t centerSolverPid;
+    int centerSolverFd;
+    int centerSolverCB;
+    int centerSolverTimerID;            /* kills a solver that runs too long */
+    int centerSolverReapID;             /* polls for the exit of a solver that closed its output */
+    char centerSolverOutput[1024];
+    size_t centerSolverLen;
+    INumber CenterOffsetN[2];
+    INumberVectorProperty CenterOffsetNP;
+    IText CenterSolverT[1];
+    ITextVectorProperty CenterSolverTP;
+    INumber CenterSettingsN[2];
+    INumberVectorProperty CenterSettingsNP;
+    ISwitch CenterS[2];
+    ISwitchVectorProperty CenterSP;
+    INumber CenterStatusN[3];
+    INumberVectorProperty CenterStatusNP;
+
+    // Site latitude reported by SiTechExe, used for local alt/az
+    double scopeSiteLatitude;
+    bool haveScopeSiteLocation;
+
+    // Horizon mask and meridian flip prediction
+    SiTechHorizonMask horizonMask;
+    IText HorizonFileT[1];
+    ITextVectorProperty HorizonFileTP;
+    INumber FlipLimitN[1];
+    INumberVectorProperty FlipLimitNP;
+    INumber LimitTimesN[2];
+    INumberVectorProperty LimitTimesNP;
+
     INumber GuideRateN[2];
     INumberVectorProperty GuideRateNP;
 